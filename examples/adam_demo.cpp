@@ -13,9 +13,11 @@ void train_with_sgd() {
 
     auto input = Tensor::create(3, 1);
     input->data = {1.0f, 2.0f, 3.0f};
+    input->requires_grad = false; // Inputs and labels never need a gradient
 
     auto target = Tensor::create(3, 1);
     target->data = {2.0f, 4.0f, 6.0f};
+    target->requires_grad = false;
 
     auto weight = Tensor::create(1, 1);
     weight->random_init();
@@ -41,9 +43,11 @@ void train_with_adam() {
 
     auto input = Tensor::create(3, 1);
     input->data = {1.0f, 2.0f, 3.0f};
+    input->requires_grad = false;
 
     auto target = Tensor::create(3, 1);
     target->data = {2.0f, 4.0f, 6.0f};
+    target->requires_grad = false;
 
     auto weight = Tensor::create(1, 1);
     weight->random_init();
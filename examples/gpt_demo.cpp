@@ -53,37 +53,28 @@ int main() {
     std::cout << "Starting training...\n";
     int epochs = 500;
 
+    // Graph nodes of each step come from here and are dropped in one go
+    GraphArena arena;
+
     for (int epoch = 0; epoch < epochs; epoch++) {
         float total_loss = 0.0f;
 
         // Train on each sequence
         for (size_t idx = 0; idx < train_inputs.size(); idx++) {
+            GraphArena::Scope step(arena);
+
             // Prepare input tensor
             auto input = Tensor::create(3, 1);
             input->data[0] = train_inputs[idx][0];
             input->data[1] = train_inputs[idx][1];
             input->data[2] = train_inputs[idx][2];
 
-            // Prepare target tensor (one-hot encoded)
-            auto target = Tensor::create(3, vocab_size);
-            std::fill(target->data.begin(), target->data.end(), 0.0f);
-            for (int i = 0; i < 3; i++) {
-                int target_token = train_targets[idx][i];
-                target->at(i, target_token) = 1.0f;
-            }
-
-            // Forward pass
-            TensorPtr logits = model.forward(input);
-
-            // Apply softmax to get probabilities
-            TensorPtr probs = softmax(logits);
-
-            // Cross-entropy loss
-            TensorPtr loss = cross_entropy_loss(probs, target);
+            // Forward pass + cross-entropy loss against the target token ids
+            TensorPtr loss = model.forward_loss(input, train_targets[idx]);
 
             // Backward pass
             optimizer.zero_grad();
-            loss->backward();
+            loss->backward(true); // Same graph shape every step, reuse the order
             optimizer.step();
 
             total_loss += loss->data[0];
@@ -97,8 +88,9 @@ int main() {
 
     std::cout << "\n=== Training Complete! ===\n\n";
 
-    // Test the model
+    // Test the model (inference only, no autograd graph)
     std::cout << "=== Testing Model ===\n\n";
+    NoGradGuard no_grad;
 
     std::vector<std::vector<int>> test_inputs = {
         {1, 2, 3},
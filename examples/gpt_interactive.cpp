@@ -55,27 +55,24 @@ int main() {
     std::cout << "🎓 Training in progress...\n\n";
     int epochs = 500;
 
+    // Graph nodes of each step come from here and are dropped in one go
+    GraphArena arena;
+
     for (int epoch = 0; epoch < epochs; epoch++) {
         float total_loss = 0.0f;
 
         for (size_t idx = 0; idx < train_inputs.size(); idx++) {
+            GraphArena::Scope step(arena);
+
             auto input = Tensor::create(3, 1);
             input->data[0] = train_inputs[idx][0];
             input->data[1] = train_inputs[idx][1];
             input->data[2] = train_inputs[idx][2];
 
-            auto target = Tensor::create(3, vocab_size);
-            std::fill(target->data.begin(), target->data.end(), 0.0f);
-            for (int i = 0; i < 3; i++) {
-                target->at(i, train_targets[idx][i]) = 1.0f;
-            }
-
-            TensorPtr logits = model.forward(input);
-            TensorPtr probs = softmax(logits);
-            TensorPtr loss = cross_entropy_loss(probs, target);
+            TensorPtr loss = model.forward_loss(input, train_targets[idx]);
 
             optimizer.zero_grad();
-            loss->backward();
+            loss->backward(true); // Same graph shape every step, reuse the order
             optimizer.step();
 
             total_loss += loss->data[0];
@@ -92,7 +89,8 @@ int main() {
 
     std::cout << "\n✅ Training Complete!\n\n";
 
-    // Testing
+    // Testing (inference only, no autograd graph)
+    NoGradGuard no_grad;
     print_separator();
     std::cout << "           🧪 Model Testing\n";
     print_separator();
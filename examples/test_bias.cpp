@@ -9,10 +9,12 @@ int main() {
     auto input = Tensor::create(2, 3);
     input->data = {1.0f, 2.0f, 3.0f,
                    4.0f, 5.0f, 6.0f};
+    input->requires_grad = false; // Inputs and labels never need a gradient
 
     auto target = Tensor::create(2, 2);
     target->data = {1.0f, 0.0f,
                     0.0f, 1.0f};
+    target->requires_grad = false;
 
     Linear layer(3, 2, true);
 
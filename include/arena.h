@@ -0,0 +1,121 @@
+/**
+ * Per-step graph arena
+ *
+ * A training step creates dozens of short lived graph nodes, each with its
+ * own data/grad buffers, prev list and backward closure. Inside a
+ * GraphArena::Scope all of those are bump-allocated from one reusable
+ * arena and released together when the scope ends:
+ *
+ *      GraphArena arena;                      // outlives the loop
+ *      for (...) {
+ *          GraphArena::Scope step(arena);     // declare it first
+ *          TensorPtr loss = ...;
+ *          optimizer.zero_grad();
+ *          loss->backward();
+ *          optimizer.step();
+ *      }                                      // tensors die, arena resets
+ *
+ * Parameters and anything else created outside a scope live on the heap
+ * as usual. Tensors from the arena must not outlive the scope.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+#include "buffer_pool.h"
+
+class GraphArena {
+public:
+    explicit GraphArena(size_t block_bytes = 1 << 20);
+    ~GraphArena();
+
+    GraphArena(const GraphArena&) = delete;
+    GraphArena& operator=(const GraphArena&) = delete;
+
+    void* allocate(size_t bytes, size_t align);
+
+    // Drop everything allocated so far, blocks are kept for the next step
+    void reset();
+
+    size_t bytes_used() const;     // in the current step
+    size_t bytes_reserved() const; // held from the system
+
+    // Live tensors allocated from this arena (must be 0 at reset)
+    int live_tensors;
+
+    // Arena receiving this thread's graph allocations, or nullptr
+    static GraphArena* current();
+
+    class Scope {
+    public:
+        explicit Scope(GraphArena& arena);
+        ~Scope(); // restores the previous arena and resets this one
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        GraphArena& arena;
+        GraphArena* prev_arena;
+    };
+
+private:
+    struct Block {
+        char* mem;
+        size_t size;
+    };
+
+    size_t block_bytes;
+    std::vector<Block> blocks;
+    size_t block_idx;
+    size_t offset;
+    size_t used;
+};
+
+/**
+ * Allocator for everything a graph node owns (data, grad, prev, the node
+ * itself). Bound to an arena it never frees, otherwise it recycles through
+ * the BufferPool. Value-initialization (resize(n)) leaves elements
+ * uninitialized, so buffers are only zeroed when asked for explicitly.
+ */
+template <typename T>
+struct TensorAllocator {
+    typedef T value_type;
+
+    GraphArena* arena;
+
+    explicit TensorAllocator(GraphArena* a = nullptr) noexcept : arena(a) {}
+    template <typename U>
+    TensorAllocator(const TensorAllocator<U>& other) noexcept : arena(other.arena) {}
+
+    // Always TENSOR_ALIGNMENT aligned, whichever source it comes from
+    T* allocate(size_t n) {
+        if (arena) return static_cast<T*>(arena->allocate(n * sizeof(T), TENSOR_ALIGNMENT));
+        return static_cast<T*>(BufferPool::instance().allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        if (!arena) BufferPool::instance().deallocate(p, n * sizeof(T));
+    }
+
+    // Default-init instead of value-init, other constructions as usual
+    template <typename U>
+    void construct(U* p) noexcept {
+        ::new (static_cast<void*>(p)) U;
+    }
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args) {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    bool operator==(const TensorAllocator<U>& other) const noexcept { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const TensorAllocator<U>& other) const noexcept { return arena != other.arena; }
+};
+
+#endif
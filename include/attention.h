@@ -0,0 +1,84 @@
+/**
+ * Memory-efficient (flash style) attention
+ *
+ *      O = softmax(scale * Q @ K^T) @ V
+ *      Q: [Sq, d]   K: [Sk, d]   V: [Sk, d]   O: [Sq, d]
+ *
+ * Queries are processed in blocks of ATTN_BLOCK_Q rows against key/value
+ * tiles of ATTN_BLOCK_K rows. An online softmax keeps a running max and
+ * sum per query row and rescales the partial output as tiles arrive, so
+ * the [Sq, Sk] score matrix never exists. Only the log-sum-exp of every
+ * row is saved; the backward recomputes the probabilities tile by tile
+ * from it. Memory is O(S * d) instead of O(S^2).
+ *
+ * causal: query i only attends to keys j <= i + (Sk - Sq), the last query
+ * lines up with the last key (Sq == Sk in training, Sq < Sk when new
+ * queries follow cached keys). Tiles above the diagonal are skipped in
+ * the forward and the backward, not computed and masked, which halves
+ * the work at long context.
+ */
+
+#ifndef ATTENTION_H
+#define ATTENTION_H
+
+#include "tensor.h"
+#include <vector>
+
+const int ATTN_BLOCK_Q = 64;
+const int ATTN_BLOCK_K = 64;
+
+// Raw buffers, row-major with row strides ld*. lse receives [Sq] floats,
+// or is null when no backward follows
+void attention_forward(int Sq, int Sk, int d, float scale, bool causal,
+                       const float* Q, int ldq, const float* K, int ldk,
+                       const float* V, int ldv, float* O, int ldo, float* lse);
+
+// attention_forward with K / V read through a page table (KVPagePool):
+// key j is row j % page_size of page pages[j / page_size], page p starts
+// at K + p * page_stride (V likewise) and its rows are ldkv apart. Key
+// tiles stop at page boundaries, nothing is gathered
+void paged_attention_forward(int Sq, int Sk, int d, float scale, bool causal,
+                             const float* Q, int ldq, const float* K, const float* V, int ldkv,
+                             size_t page_stride, const int* pages, int page_size,
+                             float* O, int ldo, float* lse);
+
+// dQ / dK / dV (+=, same strides as Q / K / V) may be null to skip them.
+// dO has the row stride of O
+void attention_backward(int Sq, int Sk, int d, float scale, bool causal,
+                        const float* Q, int ldq, const float* K, int ldk,
+                        const float* V, int ldv, const float* O, const float* dO, int ldo,
+                        const float* lse, float* dQ, float* dK, float* dV);
+
+// attention_forward for every head of a head-major layout: query head h
+// at Q + h*d, its K / V head g = h / (num_heads / num_kv_heads) at
+// K + g*d / V + g*d, output at O + h*d, lse at lse + h*Sq. Heads in parallel
+void grouped_attention_forward(int Sq, int Sk, int num_heads, int num_kv_heads, int d,
+                               float scale, bool causal,
+                               const float* Q, int ldq, const float* K, int ldk,
+                               const float* V, int ldv, float* O, int ldo, float* lse);
+
+// Autograd op on top of the kernels, returns [Sq, d]
+TensorPtr attention(TensorPtr Q, TensorPtr K, TensorPtr V, float scale, bool causal = false);
+
+/**
+ * Self-attention over the heads of a packed projection, head-major, with
+ * H query heads sharing G = num_kv_heads key/value heads (grouped-query
+ * attention; G == H is plain multi-head, G == 1 multi-query):
+ *      qkv: [S, (H + 2G) * d] = [Q_0 .. Q_H-1 | K_0 .. K_G-1 | V_0 .. V_G-1]
+ *      out: [S, H * d]        = [O_0 .. O_H-1]
+ * Query head h reads K/V head h / (H / G). Heads are read in place and
+ * written straight into their columns of the output. The forward runs
+ * query heads in parallel, the backward K/V groups (their query heads
+ * accumulate into the same dK / dV).
+ */
+TensorPtr multi_head_attention(TensorPtr qkv, int num_heads, int num_kv_heads,
+                               float scale, bool causal = false);
+
+// Same over a batch of sequences packed row after row: sequence b is rows
+// [offsets[b], offsets[b + 1]) of qkv and out (offsets: batch + 1 entries,
+// 0 first, qkv->rows last). Attention never crosses a sequence boundary,
+// so sequences of different lengths share one pass without padding
+TensorPtr multi_head_attention(TensorPtr qkv, int num_heads, int num_kv_heads,
+                               float scale, bool causal, const std::vector<int>& offsets);
+
+#endif
@@ -0,0 +1,59 @@
+/**
+ * Beam search decoding
+ *
+ *      BeamSearchConfig cfg;
+ *      cfg.beam_width = 4;
+ *      cfg.length_penalty = 1.0f;   // 0: raw log-probability
+ *      cfg.stop_token = eos;
+ *      std::vector<BeamHypothesis> best = beam_search(model, prompt, 32, cfg);
+ *      best[0].tokens;              // highest scoring continuation
+ *
+ * Keeps the beam_width most likely continuations. Every step runs ONE
+ * GPT::forward_batch_cached over all live beams (each feeds its newest
+ * token), and the next beams are the top 2 * beam_width of all
+ * beam x vocab extensions, picked by a partial sort. An extension ending
+ * in the stop token becomes a finished hypothesis, the rest fill the
+ * beam_width live slots.
+ *
+ * Beams that share a prefix share its K/V pages: a beam extended more
+ * than once forks its cache (KVCache::fork, copy-on-write), its last
+ * extension takes the cache over, so only the partly filled last page of
+ * a beam that actually branched is ever copied. The prompt is prefilled
+ * once for all beams.
+ *
+ * Hypotheses are ranked by log_prob / length^length_penalty, length in
+ * generated tokens: > 0 favours longer outputs, 0 ranks by raw
+ * log-probability. With early_stopping the search ends as soon as
+ * beam_width hypotheses finished, else once no live beam (scored at its
+ * current length) could still beat the worst of them. Either way the
+ * result then holds only finished hypotheses, beams still live are
+ * dropped.
+ */
+
+#ifndef BEAM_SEARCH_H
+#define BEAM_SEARCH_H
+
+#include "nn.h"
+#include <vector>
+
+struct BeamSearchConfig {
+    int beam_width = 4;
+    float length_penalty = 1.0f;
+    bool early_stopping = true;
+    int stop_token = -1; // ends a hypothesis (kept in its tokens), -1: none
+};
+
+struct BeamHypothesis {
+    std::vector<int> tokens; // generated after the prompt
+    float log_prob = 0.0f;   // sum over tokens
+    float score = 0.0f;      // log_prob / length^length_penalty
+};
+
+// Up to beam_width hypotheses of at most max_new_tokens, best first.
+// Beams still live when max_new_tokens or max_seq_len is reached finish
+// there (without a stop token), never when the stopping rule ends the
+// search
+std::vector<BeamHypothesis> beam_search(GPT& model, const std::vector<int>& prompt, int max_new_tokens,
+                                        const BeamSearchConfig& config = BeamSearchConfig());
+
+#endif
@@ -0,0 +1,59 @@
+/**
+ * Caching allocator for tensor storage
+ *
+ * Training loops build the same shapes every step, so freed buffers are
+ * kept in per-size-class free lists and handed out again instead of going
+ * back to malloc. Sizes are rounded up to 4 classes per power of two
+ * (at most 25% slack). Once every shape of a step has been seen, a loop
+ * runs without touching the system allocator.
+ *
+ * TensorAllocator (arena.h) uses the pool whenever no GraphArena is active.
+ * Cached memory is only returned to the system by trim().
+ * Every block starts on a TENSOR_ALIGNMENT (cache line) boundary.
+ */
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Alignment of all tensor storage, one cache line / one AVX-512 register
+static const size_t TENSOR_ALIGNMENT = 64;
+
+inline bool is_aligned(const void* p, size_t alignment = TENSOR_ALIGNMENT) {
+    return ((uintptr_t)p & (alignment - 1)) == 0;
+}
+
+class BufferPool {
+public:
+    struct Stats {
+        size_t hits;          // requests served from a free list
+        size_t misses;        // requests that went to the system
+        size_t bytes_in_use;  // handed out and not yet returned
+        size_t bytes_cached;  // sitting in the free lists
+        size_t high_water;    // peak of in_use + cached
+    };
+
+    static BufferPool& instance();
+
+    void* allocate(size_t bytes);
+    void deallocate(void* p, size_t bytes); // bytes as passed to allocate()
+
+    Stats stats() const;
+    void reset_stats(); // hits / misses / high_water, not the cache itself
+
+    // Free every cached buffer
+    void trim();
+
+private:
+    BufferPool() : stats_() {}
+
+    mutable std::mutex mutex_;
+    std::vector<std::vector<void*>> free_lists_; // one per size class
+    Stats stats_;
+};
+
+#endif
@@ -0,0 +1,37 @@
+/**
+ * Packed, cache-blocked matrix multiplication (GEMM)
+ *
+ * Row-major, BLAS style:
+ *      C = alpha * op(A) @ op(B) + beta * C
+ *
+ * op(X) is X or X^T. Transposed operands are read in place while packing,
+ * so backward passes never have to materialize a transpose.
+ *      op(A): [M, K]   op(B): [K, N]   C: [M, N]
+ * lda / ldb / ldc are the row strides of the stored matrices.
+ */
+
+#ifndef GEMM_H
+#define GEMM_H
+
+#include "kernels.h"
+
+/**
+ * Optional epilogue: once a block of C is final it becomes act(C + bias)
+ * while it is still in cache, instead of in extra passes over C.
+ * pre_act (if set) also receives C + bias, for derivatives that need
+ * the activation input (GELU).
+ */
+struct GemmEpilogue {
+    const float* bias; // [N], added to every row, or nullptr
+    Activation act;
+    float* pre_act;    // [M, ld_pre], or nullptr
+    int ld_pre;
+};
+
+void gemm(bool trans_a, bool trans_b, int M, int N, int K,
+          float alpha, const float* A, int lda,
+          const float* B, int ldb,
+          float beta, float* C, int ldc,
+          const GemmEpilogue* epilogue = nullptr);
+
+#endif
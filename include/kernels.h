@@ -0,0 +1,95 @@
+/**
+ * Low level float kernels used by ops and tensors
+ *
+ * Every hot loop over raw float buffers lives here. The library is built
+ * without any ISA flags, the best implementation for the running CPU is
+ * picked once at startup (AVX-512, AVX2 or plain scalar) and every caller
+ * goes through the same function table.
+ *
+ * The SIMD exp/tanh are polynomial approximations:
+ *      exp:  relative error < 2e-7 on [-87, 88], inputs are clamped there
+ *      tanh: absolute error < 2e-7 everywhere
+ *
+ * Set LLMON_KERNELS=scalar|avx2|avx512 to force a (supported) level,
+ * handy for debugging and for comparing results.
+ */
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstddef>
+
+// Register tile of the GEMM micro kernel, see gemm.cpp
+const int GEMM_MR = 6;
+const int GEMM_NR = 16;
+
+// Activations of the fused kernels (linear() in ops.h, GemmEpilogue in gemm.h)
+// GELU is the tanh approximation used by GPT-2
+enum class Activation { None, ReLU, Tanh, Sigmoid, GELU };
+
+struct KernelTable {
+    const char* name;
+
+    // Element-wise forward: y = f(a, b)
+    void (*add)(const float* a, const float* b, float* y, size_t n);
+    void (*sub)(const float* a, const float* b, float* y, size_t n);
+    void (*mul)(const float* a, const float* b, float* y, size_t n);
+    void (*relu)(const float* x, float* y, size_t n);
+    void (*tanh)(const float* x, float* y, size_t n);
+    void (*sigmoid)(const float* x, float* y, size_t n);
+    void (*gelu)(const float* x, float* y, size_t n);
+    void (*exp)(const float* x, float* y, size_t n);
+
+    // Gradient accumulation: dx += ...
+    void (*axpy)(float alpha, const float* x, float* dx, size_t n);              // dx += alpha * x
+    void (*scale)(float alpha, float* x, size_t n);                              // x *= alpha
+    void (*mul_acc)(const float* a, const float* b, float* dx, size_t n);         // dx += a * b
+    void (*diff_acc)(float alpha, const float* a, const float* b, float* dx, size_t n); // dx += alpha * (a - b)
+    void (*relu_backward)(const float* x, const float* dy, float* dx, size_t n);  // dx += (x > 0) * dy
+    void (*tanh_backward)(const float* y, const float* dy, float* dx, size_t n);  // dx += (1 - y^2) * dy
+    void (*sigmoid_backward)(const float* y, const float* dy, float* dx, size_t n); // dx += y * (1 - y) * dy
+    void (*gelu_backward)(const float* x, const float* dy, float* dx, size_t n);  // dx += gelu'(x) * dy
+
+    // Activation derivative applied in place: g *= f'(.), from the output y
+    // (GELU needs the input x instead)
+    void (*relu_grad)(const float* y, float* g, size_t n);
+    void (*tanh_grad)(const float* y, float* g, size_t n);
+    void (*sigmoid_grad)(const float* y, float* g, size_t n);
+    void (*gelu_grad)(const float* x, float* g, size_t n);
+
+    // Softmax of a single row
+    void (*softmax_row)(const float* x, float* y, size_t n);
+    void (*softmax_row_backward)(const float* y, const float* dy, float* dx, size_t n);
+    // sum(exp(x - max)) with max(x) in *max: log-sum-exp is max + log(sum),
+    // the log is left to the caller so the ISA files need no <cmath>
+    float (*sumexp_row)(const float* x, size_t n, float* max);
+    void (*exp_shift_acc)(float alpha, const float* x, float shift, float* dx, size_t n); // dx += alpha * exp(x - shift)
+    float (*exp_shift)(const float* x, float shift, float* y, size_t n);      // y = exp(x - shift), returns sum(y)
+    void (*softmax_grad)(const float* y, float dot, float* g, size_t n);      // g = y * (g - dot), in place
+
+    // Reductions
+    float (*sum)(const float* x, size_t n);
+    float (*max)(const float* x, size_t n);                          // -inf for n == 0
+    float (*dot)(const float* a, const float* b, size_t n);
+    float (*sq_dev_sum)(const float* x, float mean, size_t n);       // sum((x - mean)^2)
+    float (*sq_diff_sum)(const float* a, const float* b, size_t n);  // sum((a - b)^2)
+
+    // GEMM micro kernel: C[0:mr, 0:nr] += alpha * A_panel @ B_panel
+    // A_panel is kc x GEMM_MR (column of MR per step), B_panel is kc x GEMM_NR
+    void (*gemm_micro)(int kc, const float* a, const float* b,
+                       float* c, int ldc, int mr, int nr, float alpha);
+};
+
+// Table selected for this CPU (resolved on first use)
+const KernelTable& kernels();
+
+// y = act(x), in place allowed
+void activation_forward(Activation act, const float* x, float* y, size_t n);
+// g *= act'(.), y is the activation output, x its input (only read for GELU)
+void activation_grad(Activation act, const float* y, const float* x, float* g, size_t n);
+
+// Per-ISA loaders, return false when the ISA was not compiled in
+bool load_avx2_kernels(KernelTable& table);
+bool load_avx512_kernels(KernelTable& table);
+
+#endif
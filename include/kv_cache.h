@@ -0,0 +1,129 @@
+/**
+ * Key/value cache for incremental decoding
+ *
+ * Holds the keys and values of every position a sequence has seen so far,
+ * so a decoding step only projects the new token and attends against the
+ * cache instead of running the whole prefix again:
+ *
+ *      KVCache cache = model.make_cache();
+ *      TensorPtr logits = model.prefill(prompt, cache); // [1, vocab]
+ *      while (...) {
+ *          int next = pick(logits);
+ *          logits = model.forward_step(next, cache.length(), cache);
+ *      }
+ *
+ * Paged: K/V rows live in fixed-size pages of a KVPagePool, preallocated
+ * once. A cache is a page table over the pool, position p is row
+ * p % page_size of page pages()[p / page_size], and takes a page only when
+ * it grows into one. Short sequences hold a few pages instead of a
+ * max_seq_len buffer, and pages go straight back to the pool on clear() or
+ * destruction, so many caches share one fixed memory budget without
+ * fragmenting the heap:
+ *
+ *      auto pool = model.make_page_pool(1024);   // 1024 pages of KV_PAGE_SIZE
+ *      KVCache a = model.make_cache(pool), b = model.make_cache(pool);
+ *
+ * Pages are reference counted so caches can share them (a common prompt
+ * prefix, see PrefixCache). Shared pages are read-only: a cache that
+ * appends into a shared, partly filled last page copies it first
+ * (copy-on-write), full shared pages are never written again.
+ *
+ * A row holds kv_heads * head_dim floats, laid out like the K and V
+ * sections of the packed QKV projection.
+ */
+
+#ifndef KV_CACHE_H
+#define KV_CACHE_H
+
+#include "tensor.h"
+#include <memory>
+#include <vector>
+
+const int KV_PAGE_SIZE = 16; // positions per page
+
+class KVPagePool {
+public:
+    KVPagePool(int num_pages, int page_size, int kv_dim);
+
+    int num_pages() const { return num_pages_; }
+    int page_size() const { return page_size_; }
+    int kv_dim() const { return kv_dim_; }
+    int free_pages() const { return (int)free_.size(); }
+    int used_pages() const { return num_pages_ - free_pages(); }
+
+    int allocate();         // a free page with one reference, -1 when none is left
+    void retain(int page);  // one more reference
+    void release(int page); // one reference less, back to the free list at zero
+    int ref_count(int page) const { return refs_[page]; }
+
+    // Page p starts at keys() + p * page_stride(), rows kv_dim apart
+    size_t page_stride() const { return (size_t)page_size_ * kv_dim_; }
+    const float* keys() const { return keys_.data(); }
+    const float* values() const { return values_.data(); }
+    float* keys(int page) { return keys_.data() + (size_t)page * page_stride(); }
+    float* values(int page) { return values_.data() + (size_t)page * page_stride(); }
+
+private:
+    int num_pages_;
+    int page_size_;
+    int kv_dim_;
+    FloatBuffer keys_;      // [num_pages * page_size, kv_dim]
+    FloatBuffer values_;    // [num_pages * page_size, kv_dim]
+    std::vector<int> free_; // stack, the last released page is reused first
+    std::vector<int> refs_; // references per page
+};
+
+class KVCache {
+public:
+    // Own pool with just enough pages for capacity positions
+    KVCache(int capacity, int kv_dim, int page_size = KV_PAGE_SIZE);
+    // Pages drawn from a shared pool as the sequence grows
+    KVCache(std::shared_ptr<KVPagePool> pool, int capacity);
+    ~KVCache();
+
+    KVCache(KVCache&&) = default;
+    KVCache& operator=(KVCache&& other);
+    KVCache(const KVCache&) = delete;
+    KVCache& operator=(const KVCache&) = delete;
+
+    int length() const { return length_; }    // positions stored
+    int capacity() const { return capacity_; }
+    int kv_dim() const { return pool_->kv_dim(); }
+    int page_size() const { return pool_->page_size(); }
+
+    const std::vector<int>& pages() const { return pages_; } // page table
+    const KVPagePool& pool() const { return *pool_; }
+
+    // Makes room for n more positions, copying a shared last page that
+    // would be written. False (and nothing taken) when the pool has too few
+    // free pages
+    bool reserve(int n);
+
+    // Start an empty cache from the first `length` positions held in pages
+    // (another cache's or a PrefixCache's), shared rather than copied
+    void share(const std::vector<int>& pages, int length);
+
+    // A new cache on the same pool holding the same positions, every page
+    // shared: the two diverge by copy-on-write as either appends (beam search)
+    KVCache fork() const;
+
+    // Store n new positions after the current ones, rows read with strides
+    // ldk / ldv. The pool must have room (see reserve)
+    void append(const float* k, int ldk, const float* v, int ldv, int n);
+
+    // Keep only the first `length` positions, pages past them are released.
+    // A kept, now partly filled page that is shared gets copied on the next
+    // append like any other (rejected speculative tokens, see speculative.h)
+    void truncate(int length);
+
+    // Forget every position and drop its page references (unshared pages are freed)
+    void clear();
+
+private:
+    std::shared_ptr<KVPagePool> pool_;
+    int capacity_;
+    int length_;
+    std::vector<int> pages_;
+};
+
+#endif
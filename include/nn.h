@@ -3,6 +3,10 @@
 
 #include "tensor.h"
 #include "ops.h"
+#include "attention.h"
+#include "kv_cache.h"
+#include "sampling.h"
+#include <functional>
 #include <vector>
 
 /**
@@ -18,15 +22,17 @@ public:
 
 /**
  * First layer, linear fully connected
- * Formula: y = x @ w + b
+ * Formula: y = act(x @ w + b), act defaults to none
  */
 class Linear : public Module {
 public:
     TensorPtr weight;
     TensorPtr bias;
     bool use_bias;
+    Activation activation;
 
-    Linear(int in_features, int out_features, bool bias = true);
+    Linear(int in_features, int out_features, bool bias = true,
+           Activation act = Activation::None);
 
     TensorPtr forward(TensorPtr input) override;
     std::vector<TensorPtr> parameters() override;
@@ -54,13 +60,54 @@ public:
     Linear Wq; // For Query projection layer
     Linear Wk; // For Key projection layer
     Linear Wv; // For Value projection layer
+    bool causal; // Position i only attends to positions <= i
 
-    SelfAttention(int embed_dim, int head_dim);
+    SelfAttention(int embed_dim, int head_dim, bool causal = false);
 
     TensorPtr forward(TensorPtr input) override;
     std::vector<TensorPtr> parameters() override;
 };
 
+/**
+ * Multi-head self-attention
+ * One packed projection computes Q, K and V of every head in a single
+ * GEMM, the heads attend in parallel and write side by side into the
+ * input of the output projection.
+ *
+ * num_kv_heads < num_heads gives grouped-query attention: each K/V head
+ * serves num_heads / num_kv_heads query heads, so K/V projections, their
+ * activations and gradients (and later caches) shrink by that factor.
+ * num_kv_heads = 1 is multi-query attention, 0 means num_heads.
+ */
+class MultiHeadAttention : public Module {
+public:
+    int num_heads;
+    int num_kv_heads;
+    int head_dim;
+    Linear Wqkv; // [embed_dim, (num_heads + 2 * num_kv_heads) * head_dim], Q | K | V heads
+    Linear Wo;   // [num_heads * head_dim, embed_dim] output projection
+    bool causal;
+
+    MultiHeadAttention(int embed_dim, int num_heads, int head_dim, bool causal = false,
+                       int num_kv_heads = 0);
+
+    TensorPtr forward(TensorPtr input) override;
+    std::vector<TensorPtr> parameters() override;
+
+    // Batch packed row after row, sequence b is rows [offsets[b], offsets[b + 1])
+    TensorPtr forward(TensorPtr input, const std::vector<int>& offsets);
+
+    // Inference: input rows are the next positions of the cached sequence,
+    // their K/V are appended and they attend to everything cached so far
+    TensorPtr forward_cached(TensorPtr input, KVCache& cache);
+
+    // Several cached sequences in one pass: rows [offsets[b], offsets[b + 1])
+    // are the next positions of *caches[b]. Projections run as one GEMM over
+    // all rows, each sequence attends to its own cache
+    TensorPtr forward_cached(TensorPtr input, const std::vector<int>& offsets,
+                             const std::vector<KVCache*>& caches);
+};
+
 /**
  * Positional Embedding
  * Adds position information to token embeddings
@@ -72,18 +119,29 @@ public:
     PositionalEmbedding(int max_seq_len, int embedding_dim);
 
     TensorPtr forward(TensorPtr input) override;
+    TensorPtr forward(TensorPtr input, int start_pos); // rows are positions start_pos..
+    // Packed batch: rows [offsets[b], offsets[b + 1]) are positions 0.. of sequence b
+    TensorPtr forward(TensorPtr input, const std::vector<int>& offsets);
     std::vector<TensorPtr> parameters() override;
+
+    // Row i gets position positions[i]
+    TensorPtr add_positions(TensorPtr input, const std::vector<int>& positions);
 };
 
 class TransformerBlock : public Module {
 public:
-    SelfAttention attn;
+    MultiHeadAttention attn;
     Linear ffn; // Feed Forward Network
 
-    TransformerBlock(int embed_dim, int head_dim);
+    TransformerBlock(int embed_dim, int head_dim, int num_heads = 1, bool causal = false,
+                     int num_kv_heads = 0);
 
     TensorPtr forward(TensorPtr input) override;
     std::vector<TensorPtr> parameters() override;
+    TensorPtr forward(TensorPtr input, const std::vector<int>& offsets); // packed batch
+    TensorPtr forward_cached(TensorPtr input, KVCache& cache);
+    TensorPtr forward_cached(TensorPtr input, const std::vector<int>& offsets,
+                             const std::vector<KVCache*>& caches);
 };
 
 /**
@@ -101,10 +159,84 @@ public:
     TransformerBlock transformer;
     Linear output_head;
 
-    GPT(int vocab_size, int embed_dim, int max_seq_len, int head_dim);
+    // head_dim per head, num_heads heads of it feed the output projection,
+    // sharing num_kv_heads K/V heads (0: one per query head)
+    GPT(int vocab_size, int embed_dim, int max_seq_len, int head_dim, int num_heads = 1,
+        int num_kv_heads = 0);
 
     TensorPtr forward(TensorPtr input) override;
     std::vector<TensorPtr> parameters() override;
+
+    // Hidden states [seq_len, embed_dim] fed to the output head
+    TensorPtr forward_hidden(TensorPtr input);
+
+    // Several sequences in one pass: input [batch, seq] token ids, padded
+    // on the right, sequence b has lengths[b] real tokens. Returns logits
+    // [batch * seq, vocab_size], row b * seq + t is position t of sequence b
+    // and padding rows are zero. Real tokens are packed before the model
+    // runs, so every projection is a single GEMM over all of them and
+    // padding costs nothing
+    TensorPtr forward_batch(TensorPtr input, const std::vector<int>& lengths);
+
+    // Training loss against next-token ids, output head fused with the loss:
+    // the [seq_len, vocab_size] logits are never materialized
+    TensorPtr forward_loss(TensorPtr input, const std::vector<int>& targets, int vocab_chunk = 2048);
+
+    // === Incremental decoding (inference, never records a graph) ===
+
+    // Empty cache for max_seq_len positions of this model, with its own pages
+    KVCache make_cache();
+
+    // Page pool shared by many caches: num_pages pages of page_size positions
+    std::shared_ptr<KVPagePool> make_page_pool(int num_pages, int page_size = KV_PAGE_SIZE);
+    // Empty cache drawing its pages from pool as it grows
+    KVCache make_cache(std::shared_ptr<KVPagePool> pool);
+
+    // Runs tokens as the next positions of the cached sequence and returns
+    // the logits of the last one [1, vocab_size]. Used for the prompt
+    TensorPtr prefill(const std::vector<int>& tokens, KVCache& cache);
+
+    // One new token at position pos (== cache.length()), only its
+    // projections are computed, attention reads the rest from the cache
+    TensorPtr forward_step(int token, int pos, KVCache& cache);
+
+    // One step over several cached sequences (continuous batching):
+    // sequence b feeds tokens [offsets[b], offsets[b + 1]) as its next
+    // positions in *caches[b], a prompt chunk or a single decoded token.
+    // Returns the logits of each sequence's last row [batch, vocab_size]
+    TensorPtr forward_batch_cached(const std::vector<int>& tokens, const std::vector<int>& offsets,
+                                   const std::vector<KVCache*>& caches);
+
+    // Like prefill() but returns the logits of every new position
+    // [tokens.size(), vocab_size], row i predicts the token after tokens[i].
+    // Scores a run of proposed tokens in one pass (speculative decoding)
+    TensorPtr score(const std::vector<int>& tokens, KVCache& cache);
+
+    // Decodes up to max_new_tokens after the prompt through a KV cache,
+    // on_token sees each token as soon as it is picked. Stops early after
+    // config.stop_token or when the context (max_seq_len) is full
+    std::vector<int> generate(const std::vector<int>& prompt, int max_new_tokens,
+                              const SamplingConfig& config = SamplingConfig(),
+                              const std::function<void(int)>& on_token = nullptr);
+
+private:
+    // Host-side inputs of one cached step, kept by a decode loop so that
+    // after the first step a step allocates nothing outside the graph arena
+    struct StepBuffers {
+        std::vector<int> tokens;
+        std::vector<int> offsets;
+        std::vector<KVCache*> caches;
+        std::vector<int> positions;
+    };
+
+    // prefill() on a raw token array, logits of the last one
+    TensorPtr forward_cached(const int* tokens, int n, KVCache& cache, StepBuffers& buffers);
+    // forward_batch_cached() writing the row positions into a caller's buffer
+    TensorPtr forward_batch_cached(const std::vector<int>& tokens, const std::vector<int>& offsets,
+                                   const std::vector<KVCache*>& caches, std::vector<int>& positions);
+    // Final hidden states [tokens.size(), embed_dim] of a forward_batch_cached step
+    TensorPtr hidden_cached(const std::vector<int>& tokens, const std::vector<int>& offsets,
+                            const std::vector<KVCache*>& caches, std::vector<int>& positions);
 };
 
 #endif
\ No newline at end of file
@@ -7,22 +7,46 @@
 #define OPS_H
 
 #include "tensor.h"
+#include "kernels.h"
 
 // Basic Operations
-TensorPtr matmul(TensorPtr A, TensorPtr B);
+TensorPtr matmul(TensorPtr A, TensorPtr B, float alpha = 1.0f); // alpha * A @ B
 TensorPtr relu(TensorPtr input);
 TensorPtr sub(TensorPtr A, TensorPtr B);
-TensorPtr transpose(TensorPtr A);
 TensorPtr softmax(TensorPtr input);
 
+// Fused act(input @ weight + bias), bias may be null. Bias and activation
+// run in the GEMM epilogue, their gradients in a single backward sweep
+TensorPtr linear(TensorPtr input, TensorPtr weight, TensorPtr bias,
+                 Activation act = Activation::None);
+
+// Views, O(1): share the source's data and gradient (see Tensor::base)
+TensorPtr transpose(TensorPtr A);
+TensorPtr narrow(TensorPtr A, int dim, int start, int length); // dim 0: rows, 1: cols
+TensorPtr row(TensorPtr A, int i);                             // [1, cols]
+TensorPtr contiguous(TensorPtr A); // A itself if already dense, else a copy
+
+// [rows, A->cols] of zeros with row index[i] = A row i (indices distinct),
+// unpacks rows packed back to back into a padded layout
+TensorPtr scatter_rows(TensorPtr A, const std::vector<int>& index, int rows);
+
 // Loss Functions
 TensorPtr mse_loss(TensorPtr pred, TensorPtr target);
 TensorPtr cross_entropy_loss(TensorPtr pred, TensorPtr target);
+// Softmax + cross entropy on raw logits against one class index per row,
+// the gradient softmax - onehot is produced directly
+TensorPtr cross_entropy_with_logits(TensorPtr logits, const std::vector<int>& targets);
+// cross_entropy_with_logits(linear(input, weight, bias), targets) without
+// the [rows, vocab] logits: the vocabulary is streamed in column chunks,
+// forward and backward hold O(rows * chunk) floats (bias may be null)
+TensorPtr linear_cross_entropy(TensorPtr input, TensorPtr weight, TensorPtr bias,
+                               const std::vector<int>& targets, int chunk = 2048);
 
 // Additional Useful Operations
 TensorPtr add(TensorPtr A, TensorPtr B);
 TensorPtr multiply(TensorPtr A, TensorPtr B); // Element-wise
 TensorPtr tanh_activation(TensorPtr input);
 TensorPtr sigmoid(TensorPtr input);
+TensorPtr gelu(TensorPtr input); // tanh approximation
 
 #endif
\ No newline at end of file
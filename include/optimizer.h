@@ -15,6 +15,7 @@ public:
 
     void step() {
         for (auto& p : parameters) {
+            if (p->grad.empty()) continue; // No gradient this step
             for (size_t i = 0; i < p->data.size(); i++) {
                 p->data[i] -= learning_rate * p->grad[i];
             }
@@ -61,6 +62,7 @@ public:
 
         for (size_t p_idx = 0; p_idx < parameters.size(); p_idx++) {
             auto& p = parameters[p_idx];
+            if (p->grad.empty()) continue; // No gradient this step
             for (size_t i = 0; i < p->data.size(); i++) {
                 float grad = p->grad[i];
 
@@ -0,0 +1,87 @@
+/**
+ * Shared-prefix KV cache
+ *
+ * Keeps the K/V pages of prompt prefixes that were already computed so a
+ * new request starting with the same tokens (a system preamble, earlier
+ * chat turns) attaches those pages instead of running them through the
+ * model again:
+ *
+ *      PrefixCache prefixes(pool, 256);          // keeps at most 256 pages
+ *      KVCache cache = model.make_cache(pool);
+ *      int reused = prefixes.match(prompt, cache); // cache.length() == reused
+ *      model.prefill(rest of prompt, cache);
+ *      prefixes.insert(prompt, cache);           // publish for later requests
+ *
+ * A radix tree over token blocks: each node is one full page, page_size
+ * tokens, children keyed by a hash of their block (tokens compared on a
+ * match, so a collision is just a miss). The path from the root spells
+ * the prefix, so a node's page is valid for exactly that prefix. Pages
+ * are shared by reference count: a matched cache reads them in place and
+ * copies on write (KVCache::reserve). Partial blocks are never cached,
+ * a match always ends on a page boundary.
+ *
+ * The tree holds at most max_pages pages. Past that, or when the pool
+ * needs pages back (evict()), least recently used leaves go first, and
+ * only pages no live sequence is reading are dropped.
+ */
+
+#ifndef PREFIX_CACHE_H
+#define PREFIX_CACHE_H
+
+#include "kv_cache.h"
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class PrefixCache {
+public:
+    PrefixCache(std::shared_ptr<KVPagePool> pool, int max_pages);
+    ~PrefixCache(); // releases every page it holds
+
+    PrefixCache(const PrefixCache&) = delete;
+    PrefixCache& operator=(const PrefixCache&) = delete;
+
+    // Attaches the longest cached prefix of tokens to an empty cache and
+    // returns its length (whole pages). At least one token is left over so
+    // the caller still gets logits for the last one
+    int match(const std::vector<int>& tokens, KVCache& cache);
+
+    // Publishes the full pages of cache, whose positions hold tokens[0..)
+    void insert(const std::vector<int>& tokens, const KVCache& cache);
+
+    // Drops least recently used pages nobody else reads until `pages` went
+    // back to the pool or nothing is left to drop, returns how many did
+    int evict(int pages);
+
+    int cached_pages() const { return num_nodes_; }
+    int evictable_pages() const; // held by the tree alone
+
+    uint64_t lookups() const { return lookups_; }
+    uint64_t hit_tokens() const { return hit_tokens_; } // positions reused by match()
+
+private:
+    struct Node {
+        std::vector<int> tokens; // this node's block
+        int page = -1;
+        uint64_t last_used = 0;
+        Node* parent = nullptr;
+        std::unordered_map<uint64_t, std::unique_ptr<Node>> children; // by block hash
+    };
+
+    std::shared_ptr<KVPagePool> pool_;
+    int max_pages_;
+    Node root_;
+    int num_nodes_ = 0;
+    uint64_t clock_ = 0; // LRU time, one tick per match / insert
+    uint64_t lookups_ = 0;
+    uint64_t hit_tokens_ = 0;
+
+    Node* child(Node* node, const int* block); // null when absent
+    bool evict_one(uint64_t before);            // LRU leaf last used before `before`
+    void release_subtree(Node* node);
+    void collect_evictable(Node* node, std::vector<Node*>& leaves) const;
+    int count_evictable(const Node* node, bool* whole) const;
+};
+
+#endif
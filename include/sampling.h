@@ -0,0 +1,57 @@
+/**
+ * Next-token sampling for GPT::generate
+ *
+ *      SamplingConfig cfg;          // greedy by default
+ *      cfg.temperature = 0.8f;      // > 0 samples
+ *      cfg.top_k = 40;              // keep the 40 most likely tokens
+ *      cfg.top_p = 0.95f;           // then the smallest set with 95% of the mass
+ *      cfg.seed = 1234;             // same seed, same tokens
+ *
+ * Sampler owns its scratch buffers (sized to the vocabulary once), picking
+ * a token never allocates. Top-k is a partial selection (nth_element) and
+ * top-p a quickselect on the cumulative mass, so a pick is O(vocab)
+ * instead of a full sort.
+ */
+
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+struct SamplingConfig {
+    float temperature = 0.0f; // 0: greedy (argmax), else logits / temperature
+    int top_k = 0;            // 0: whole vocabulary
+    float top_p = 1.0f;       // nucleus mass, 1: off
+    uint64_t seed = 0;
+    int stop_token = -1;      // generation ends after emitting it, -1: none
+};
+
+class Sampler {
+public:
+    Sampler(const SamplingConfig& config, int vocab_size);
+
+    // Token drawn from logits [vocab_size]
+    int sample(const float* logits);
+
+    // The distribution sample() draws from, written to probs [vocab_size]:
+    // temperature, top-k and top-p applied, zero outside the kept set
+    // (one-hot on the argmax when greedy)
+    void probabilities(const float* logits, float* probs);
+
+    const SamplingConfig& config() const { return config_; }
+
+private:
+    SamplingConfig config_;
+    int vocab_size_;
+    std::mt19937_64 rng_;
+    // (scaled logit, later unnormalized probability; token id)
+    std::vector<std::pair<float, int>> candidates_;
+
+    int keep(const float* logits, float* total); // kept candidates in front, their weight sum
+    int nucleus(int n, float mass); // size of the top-p set among the first n
+};
+
+#endif
@@ -0,0 +1,170 @@
+/**
+ * In-process serving engine with continuous batching
+ *
+ *      InferenceServer server(model);
+ *      server.start();                                  // engine thread
+ *      GenerationRequest req;
+ *      req.prompt = {1, 2, 3};
+ *      req.max_new_tokens = 32;
+ *      std::future<GenerationResult> f = server.submit(req); // any thread
+ *      GenerationResult r = f.get();
+ *      server.stop();                                   // drains, then joins
+ *
+ * Requests wait in a thread-safe queue. Every tick the engine admits
+ * queued requests (up to max_batch live sequences), retires the finished
+ * ones, and runs ONE batched forward (GPT::forward_batch_cached) over all
+ * live sequences: a decoding sequence contributes its last token, a new
+ * one a chunk of its prompt (chunked prefill, at most max_tokens_per_tick
+ * prompt rows per tick so decoding sequences keep a steady pace). Every
+ * projection is a GEMM over all of those rows instead of one GEMV per
+ * user.
+ *
+ * KV memory is one page pool (kv_pages pages) shared by every sequence,
+ * a sequence takes pages as it grows and returns them when it retires, so
+ * short requests don't reserve max_seq_len positions each. A request is
+ * admitted once the pool could hold its prompt. When a sequence needs a
+ * page and none is free, the youngest sequence outside the current batch
+ * is preempted: its pages are released and its prompt plus the tokens it
+ * has produced are prefilled again later (recompute, its output is not
+ * affected). The oldest sequence can always proceed.
+ *
+ * With prefix_cache_pages > 0 computed prompt pages are kept in a
+ * PrefixCache: a new request attaches the longest cached prefix of its
+ * prompt and only prefills the rest. Prompts are published once
+ * prefilled, whole contexts when they finish. The cache gives pages back
+ * (LRU) before any sequence is preempted.
+ *
+ * Each result reports time to first token and inter-token latency,
+ * stats() the totals and generated tokens per second.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "nn.h"
+#include "prefix_cache.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct GenerationRequest {
+    std::vector<int> prompt;
+    int max_new_tokens = 16;
+    SamplingConfig sampling;
+    std::function<void(int)> on_token; // streams tokens, runs on the engine thread
+};
+
+struct GenerationResult {
+    uint64_t id = 0;
+    std::vector<int> tokens; // generated tokens, prompt excluded
+    double ttft_ms = 0.0;     // submit -> first token
+    double mean_itl_ms = 0.0; // mean gap between consecutive tokens
+    double total_ms = 0.0;    // submit -> last token
+};
+
+struct ServerConfig {
+    int max_batch = 16;            // live sequences per tick
+    int max_tokens_per_tick = 256; // prompt rows per tick (decode rows come on top)
+    int kv_pages = 0;              // KV page pool size, 0: max_batch full-length sequences
+    int kv_page_size = KV_PAGE_SIZE;
+    int prefix_cache_pages = 0;    // pages kept for shared prompt prefixes, 0: off
+};
+
+struct ServerStats {
+    uint64_t requests_completed = 0;
+    uint64_t tokens_generated = 0;
+    uint64_t ticks = 0;
+    double busy_seconds = 0.0;    // time spent in ticks
+    double tokens_per_sec = 0.0;  // tokens_generated / busy_seconds
+    double mean_ttft_ms = 0.0;
+    double mean_itl_ms = 0.0;
+    double mean_batch_size = 0.0; // sequences per tick
+    uint64_t preemptions = 0;     // sequences evicted to free KV pages
+    int kv_pages_used = 0;        // pages held right now, of kv_pages_total
+    int kv_pages_peak = 0;
+    int kv_pages_total = 0;
+    uint64_t prompt_tokens = 0;
+    uint64_t prefix_hit_tokens = 0; // prompt positions attached from the prefix cache
+};
+
+class InferenceServer {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    InferenceServer(GPT& model, const ServerConfig& config = ServerConfig());
+    ~InferenceServer(); // stop()
+
+    // Thread-safe, the future is fulfilled when the request finishes
+    std::future<GenerationResult> submit(GenerationRequest request);
+
+    // Engine loop on a background thread; stop() lets it finish every
+    // active and queued request, then joins it
+    void start();
+    void stop();
+
+    // One tick on the calling thread (without start()), false when idle
+    bool step();
+
+    ServerStats stats() const;
+
+private:
+    struct Pending {
+        uint64_t id;
+        GenerationRequest request;
+        std::promise<GenerationResult> promise;
+        Clock::time_point submitted;
+    };
+
+    struct Sequence {
+        Pending pending;
+        KVCache cache;
+        Sampler sampler;
+        std::vector<int> context; // prompt, then generated tokens; cache holds a prefix
+        Clock::time_point first_token, last_token;
+        bool scheduled = false;   // in the current tick's batch
+        bool finished = false;
+
+        Sequence(Pending p, KVCache c, int vocab_size);
+        int generated() const { return (int)(context.size() - pending.request.prompt.size()); }
+    };
+
+    GPT& model_;
+    ServerConfig config_;
+    std::shared_ptr<KVPagePool> pool_;
+    std::unique_ptr<PrefixCache> prefix_; // null when off
+    GraphArena arena_; // per-tick activations
+
+    // Request queue, shared with submitting threads
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+    std::deque<Pending> queue_;
+    uint64_t next_id_ = 1;
+    bool stopping_ = false;
+
+    std::vector<std::unique_ptr<Sequence>> active_; // engine thread only, oldest first
+    std::thread loop_;
+
+    mutable std::mutex stats_mutex_;
+    ServerStats stats_;
+    double ttft_sum_ms_ = 0.0;
+    uint64_t ttft_count_ = 0;
+    double itl_sum_ms_ = 0.0;
+    uint64_t itl_count_ = 0;
+    uint64_t batch_sum_ = 0;
+
+    void run();
+    void admit();
+    bool schedule(size_t i, int n, std::vector<int>& tokens, std::vector<int>& offsets,
+                  std::vector<KVCache*>& caches, std::vector<Sequence*>& batch);
+    void retire();
+    void finish(Sequence& seq);
+};
+
+#endif
@@ -0,0 +1,81 @@
+/**
+ * Speculative decoding with a small draft model
+ *
+ *      GPT target(vocab, 256, ctx, 64, 4), draft(vocab, 64, ctx, 32, 2);
+ *      SpeculativeDecoder spec(target, draft);
+ *      std::vector<int> out = spec.generate(prompt, 64, sampling);
+ *      spec.stats().acceptance_rate();
+ *
+ * Every round the draft (same vocabulary, much cheaper) proposes k tokens
+ * one at a time, then the target scores all of them in ONE cached pass
+ * (GPT::score) instead of k sequential steps. Proposal d_i, drawn from the
+ * draft's distribution q_i, is kept with probability min(1, p_i(d_i) /
+ * q_i(d_i)) against the target's p_i; the first rejected one is replaced
+ * by a draw from max(0, p_i - q_i) (renormalized) and the round ends.
+ * When all k pass, p_{k+1} adds one more token for free. Each committed
+ * token is distributed exactly as if the target alone had sampled it
+ * (both sides go through the same SamplingConfig, so greedy decoding
+ * reproduces the target's greedy output), the draft only changes how many
+ * target passes it takes.
+ *
+ * Rejected positions are cut off both caches (KVCache::truncate). With
+ * adaptive k the next round's k maximizes expected tokens per unit of
+ * work, (1 - a^(k+1)) / ((1 - a) (k c + 1)), from the running acceptance
+ * rate a and the measured draft step / target pass cost ratio c. k never
+ * drops below 1, so a draft that starts agreeing again is noticed.
+ */
+
+#ifndef SPECULATIVE_H
+#define SPECULATIVE_H
+
+#include "nn.h"
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+struct SpeculativeConfig {
+    int k = 4;            // draft tokens per round, the starting value when adaptive
+    int max_k = 8;
+    bool adaptive = true; // retune k every round from acceptance and cost
+};
+
+struct SpeculativeStats {
+    uint64_t rounds = 0;          // target passes
+    uint64_t proposed = 0;        // draft tokens scored
+    uint64_t accepted = 0;        // draft tokens kept
+    uint64_t generated = 0;       // tokens committed, accepted ones included
+    double draft_seconds = 0.0;
+    double target_seconds = 0.0;
+
+    double acceptance_rate() const { return proposed ? (double)accepted / proposed : 0.0; }
+    double tokens_per_round() const { return rounds ? (double)generated / rounds : 0.0; }
+};
+
+class SpeculativeDecoder {
+public:
+    // draft must share the target's vocabulary. Both are only read
+    SpeculativeDecoder(GPT& target, GPT& draft, const SpeculativeConfig& config = SpeculativeConfig());
+
+    // Same contract as GPT::generate on the target: up to max_new_tokens
+    // after the prompt, on_token sees each committed token, stops after
+    // sampling.stop_token or when either model's context is full
+    std::vector<int> generate(const std::vector<int>& prompt, int max_new_tokens,
+                              const SamplingConfig& sampling = SamplingConfig(),
+                              const std::function<void(int)>& on_token = nullptr);
+
+    int k() const { return k_; } // draft length of the next round
+    const SpeculativeStats& stats() const { return stats_; } // since construction
+
+private:
+    GPT& target_;
+    GPT& draft_;
+    SpeculativeConfig config_;
+    int k_;
+    double acceptance_ = 0.8; // running per-token estimate
+    double cost_ratio_ = -1.0; // draft step / target pass, < 0 until measured
+    SpeculativeStats stats_;
+
+    void adapt(int k, int accepted, double draft_seconds, double target_seconds);
+};
+
+#endif
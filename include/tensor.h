@@ -13,34 +13,200 @@
 #define TENSOR_H
 
 #include <vector>
+#include <cstdint>
 #include <iostream>
 #include <memory>
-#include <functional>
-#include <set>
+#include <initializer_list>
+#include <type_traits>
+#include <utility>
+#include "arena.h"
 
 struct Tensor;
 
 using TensorPtr = std::shared_ptr<Tensor>;
+using FloatBuffer = std::vector<float, TensorAllocator<float>>;
+
+/**
+ * Global (per thread) autograd switch
+ * When disabled, ops don't record prev/_backward and new tensors
+ * don't require grad. Use NoGradGuard instead of calling this directly.
+ */
+struct GradMode {
+    static bool is_enabled();
+    static void set_enabled(bool enabled);
+};
+
+/**
+ * Scoped inference mode, like `with torch.no_grad():`
+ *
+ *      {
+ *          NoGradGuard no_grad;
+ *          TensorPtr logits = model.forward(input); // no graph, no grads
+ *      }
+ */
+class NoGradGuard {
+public:
+    NoGradGuard() : prev_mode(GradMode::is_enabled()) { GradMode::set_enabled(false); }
+    ~NoGradGuard() { GradMode::set_enabled(prev_mode); }
+
+    NoGradGuard(const NoGradGuard&) = delete;
+    NoGradGuard& operator=(const NoGradGuard&) = delete;
+
+private:
+    bool prev_mode;
+};
+
+/**
+ * Backward step of a graph node, a move-only std::function<void()>
+ * The closure is stored in the current GraphArena when there is one,
+ * otherwise in the BufferPool. Closures capture raw Tensor*: the output owns
+ * its inputs through prev, so they are alive whenever the step runs.
+ */
+class BackwardFn {
+public:
+    BackwardFn() : obj(nullptr), invoke(nullptr), destroy(nullptr) {}
+    ~BackwardFn() { reset(); }
+
+    BackwardFn(BackwardFn&& other) noexcept
+        : obj(other.obj), invoke(other.invoke), destroy(other.destroy) {
+        other.obj = nullptr;
+        other.invoke = nullptr;
+        other.destroy = nullptr;
+    }
+
+    BackwardFn& operator=(BackwardFn&& other) noexcept {
+        if (this != &other) {
+            reset();
+            std::swap(obj, other.obj);
+            std::swap(invoke, other.invoke);
+            std::swap(destroy, other.destroy);
+        }
+        return *this;
+    }
+
+    template <typename F,
+              typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, BackwardFn>::value>::type>
+    BackwardFn& operator=(F&& f) {
+        typedef typename std::decay<F>::type Fn;
+        reset();
+        GraphArena* arena = GraphArena::current();
+        if (arena) {
+            obj = new (arena->allocate(sizeof(Fn), alignof(Fn))) Fn(std::forward<F>(f));
+            destroy = [](void* p) { static_cast<Fn*>(p)->~Fn(); };
+        } else {
+            obj = new (BufferPool::instance().allocate(sizeof(Fn))) Fn(std::forward<F>(f));
+            destroy = [](void* p) {
+                static_cast<Fn*>(p)->~Fn();
+                BufferPool::instance().deallocate(p, sizeof(Fn));
+            };
+        }
+        invoke = [](void* p) { (*static_cast<Fn*>(p))(); };
+        return *this;
+    }
+
+    BackwardFn(const BackwardFn&) = delete;
+    BackwardFn& operator=(const BackwardFn&) = delete;
+
+    void operator()() const { if (invoke) invoke(obj); }
+    explicit operator bool() const { return invoke != nullptr; }
+
+    void reset() {
+        if (destroy) destroy(obj);
+        obj = nullptr;
+        invoke = nullptr;
+        destroy = nullptr;
+    }
+
+private:
+    void* obj;
+    void (*invoke)(void*);
+    void (*destroy)(void*);
+};
 
 struct Tensor {
     int rows;
     int cols;
-    std::vector<float> data;
-    std::vector<float> grad;
+    FloatBuffer data;
+    FloatBuffer grad; // Empty until a gradient flows in, see grad_data()
+
+    /**
+     * Views (transpose, narrow, row) own no data or grad: they read and
+     * accumulate into `base`'s buffers. Element (i, j) lives at
+     *      offset + i * row_stride + j * col_stride
+     * of the storage, for a plain tensor that is i * cols + j.
+     * Use at() / ptr() / grad_data() rather than data / grad on views.
+     */
+    TensorPtr base; // Storage owner (never a view itself), null for plain tensors
+    size_t offset;
+    int row_stride;
+    int col_stride;
+
+    /**
+     * requires_grad: gradients flow into this tensor (default: on, unless
+     * created under NoGradGuard). Set it off for inputs and targets.
+     * retain_grad: keep the gradient of an intermediate after backward(),
+     * by default only leaves (parameters) keep theirs.
+     */
+    bool requires_grad;
+    bool retain_grad;
+
+    std::vector<TensorPtr, TensorAllocator<TensorPtr>> prev;
 
-    std::vector<TensorPtr> prev;
+    BackwardFn _backward;
 
-    std::function<void()> _backward;
+    GraphArena* arena; // Arena holding this node's storage, or nullptr
 
-    Tensor(int r, int c);
-    static TensorPtr create(int r, int c);
+    // Graph walk scratch: traversal that last visited it, position in its order
+    uint64_t visit_mark;
+    int topo_index;
+
+    Tensor(int r, int c, bool zero_init = true, int pitch = 0); // pitch: row stride, 0 = cols
+    ~Tensor();
+    static TensorPtr create(int r, int c); // Zero filled, from the current GraphArena if any
+    static TensorPtr empty(int r, int c);  // Same, but data is left uninitialized
+
+    // Zero filled, rows padded so each one starts on a TENSOR_ALIGNMENT boundary
+    // (row_stride > cols, so it is not contiguous for element-wise ops)
+    static TensorPtr create_padded(int r, int c);
+
+    // r x c view over src's storage, offset and strides in storage elements
+    static TensorPtr view(const TensorPtr& src, int r, int c,
+                          size_t offset, int row_stride, int col_stride);
+
+    Tensor(const Tensor&) = delete;
+    Tensor& operator=(const Tensor&) = delete;
 
     // Methods
     void random_init();
     void zero_grad();
-    void backward();
+    /**
+     * Backprop from this tensor. With reuse_order the topological order of
+     * the previous reuse_order call on this thread is replayed when the
+     * graph has the same shape (e.g. the next training step), otherwise it
+     * is rebuilt and remembered.
+     */
+    void backward(bool reuse_order = false);
+
+    // Autograd bookkeeping for op outputs: links the inputs and returns
+    // true when a backward step must be recorded
+    bool track(std::initializer_list<TensorPtr> inputs);
+
+    float* grad_data(); // Gradient buffer (offset applied), allocated (zeroed) on first use
+
+    // First element, with the view offset applied
+    float* ptr() { return (base ? base->data.data() : data.data()) + offset; }
+    const float* ptr() const { return (base ? base->data.data() : data.data()) + offset; }
+
+    size_t size() const { return (size_t)rows * cols; }
+    bool is_view() const { return base != nullptr; }
+    // Largest power of two, up to TENSOR_ALIGNMENT bytes, every row start is aligned to
+    size_t row_alignment() const;
+    // Row-major with no gaps, so ptr() can be read as a flat array
+    bool is_contiguous() const {
+        return (col_stride == 1 || cols <= 1) && (row_stride == cols || rows <= 1);
+    }
 
-    float& at(int i, int j);
+    float& at(int i, int j) { return ptr()[(size_t)i * row_stride + (size_t)j * col_stride]; }
     float& grad_at(int i, int j);
     void print() const;
     void print_grad() const; // Print gradients
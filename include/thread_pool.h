@@ -0,0 +1,96 @@
+/**
+ * Library-wide thread pool
+ *
+ * One persistent set of worker threads shared by every op. Work is split
+ * with parallel_for(n, grain, fn): [0, n) is cut into chunks of at least
+ * `grain` items and fn(begin, end) runs on the workers and on the calling
+ * thread. If n fits in a single chunk (tiny shapes), fn just runs inline,
+ * so small models never pay for synchronization.
+ *
+ * Size: hardware threads by default, LLMON_NUM_THREADS overrides it and
+ * ThreadPool::instance().set_num_threads(n) changes it at runtime.
+ * Nested parallel_for calls run serially on the current thread.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    typedef void (*ChunkFn)(void* ctx, int64_t begin, int64_t end);
+
+    static ThreadPool& instance();
+
+    ~ThreadPool();
+
+    // Total threads used by parallel_for, including the caller
+    int num_threads() const { return num_threads_; }
+    void set_num_threads(int n); // don't call while a parallel_for is running
+
+    // Run fn(ctx, begin, end) over [0, n) in chunks of `chunk`, blocks until done
+    void run(int64_t n, int64_t chunk, ChunkFn fn, void* ctx);
+
+    // True inside a parallel region (nested calls run serially)
+    static bool in_parallel();
+
+private:
+    ThreadPool();
+    void start_workers();
+    void stop_workers();
+    void worker_loop();
+    void work();
+
+    int num_threads_;
+    std::vector<std::thread> workers_;
+
+    std::mutex submit_mutex_; // one parallel region at a time
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    bool stop_;
+    bool active_;
+    uint64_t generation_;
+    int in_job_;
+
+    // Current job
+    ChunkFn fn_;
+    void* ctx_;
+    int64_t n_;
+    int64_t chunk_;
+    int64_t num_chunks_;
+    std::atomic<int64_t> next_chunk_;
+    std::atomic<int64_t> done_chunks_;
+};
+
+template <typename F>
+void parallel_for_invoke(void* ctx, int64_t begin, int64_t end) {
+    (*static_cast<const F*>(ctx))(begin, end);
+}
+
+// fn(begin, end) over [0, n), chunks hold at least `grain` items
+template <typename F>
+void parallel_for(int64_t n, int64_t grain, const F& fn) {
+    if (n <= 0) return;
+    ThreadPool& pool = ThreadPool::instance();
+    int threads = pool.num_threads();
+    if (grain < 1) grain = 1;
+
+    if (threads <= 1 || n <= grain || ThreadPool::in_parallel()) {
+        fn((int64_t)0, n);
+        return;
+    }
+
+    // A few chunks per thread for load balancing, but never below grain
+    int64_t chunk = (n + threads * 4 - 1) / (threads * 4);
+    if (chunk < grain) chunk = grain;
+    pool.run(n, chunk, &parallel_for_invoke<F>, (void*)&fn);
+}
+
+#endif
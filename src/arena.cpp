@@ -0,0 +1,66 @@
+#include "../include/arena.h"
+#include <cassert>
+#include <cstdint>
+
+static thread_local GraphArena* current_arena = nullptr;
+
+GraphArena::GraphArena(size_t block_bytes)
+    : live_tensors(0), block_bytes(block_bytes), block_idx(0), offset(0), used(0) {}
+
+GraphArena::~GraphArena() {
+    assert(live_tensors == 0 && "tensors from this arena are still alive");
+    for (Block& b : blocks) ::operator delete(b.mem, std::align_val_t(TENSOR_ALIGNMENT));
+}
+
+void* GraphArena::allocate(size_t bytes, size_t align) {
+    if (bytes == 0) bytes = 1;
+
+    // First block (from the current one on) with room for the request
+    for (; block_idx < blocks.size(); block_idx++, offset = 0) {
+        Block& b = blocks[block_idx];
+        uintptr_t base = (uintptr_t)b.mem;
+        uintptr_t p = (base + offset + align - 1) & ~(uintptr_t)(align - 1);
+        if (p + bytes <= base + b.size) {
+            offset = p + bytes - base;
+            used += bytes;
+            return (void*)p;
+        }
+    }
+
+    // Nothing fits, add a block (oversized requests get their own)
+    size_t size = bytes + align > block_bytes ? bytes + align : block_bytes;
+    blocks.push_back({static_cast<char*>(::operator new(size, std::align_val_t(TENSOR_ALIGNMENT))), size});
+    block_idx = blocks.size() - 1;
+    offset = 0;
+    return allocate(bytes, align);
+}
+
+void GraphArena::reset() {
+    assert(live_tensors == 0 && "tensors from the arena outlived its scope");
+    block_idx = 0;
+    offset = 0;
+    used = 0;
+}
+
+size_t GraphArena::bytes_used() const {
+    return used;
+}
+
+size_t GraphArena::bytes_reserved() const {
+    size_t total = 0;
+    for (const Block& b : blocks) total += b.size;
+    return total;
+}
+
+GraphArena* GraphArena::current() {
+    return current_arena;
+}
+
+GraphArena::Scope::Scope(GraphArena& arena) : arena(arena), prev_arena(current_arena) {
+    current_arena = &arena;
+}
+
+GraphArena::Scope::~Scope() {
+    current_arena = prev_arena;
+    arena.reset();
+}
@@ -0,0 +1,375 @@
+#include "../include/attention.h"
+#include "../include/ops.h"
+#include "../include/gemm.h"
+#include "../include/thread_pool.h"
+#include <cassert>
+#include <algorithm>
+#include <cmath>
+
+// Keys visible to query row i: all, or with a causal mask the first
+// i + 1 + (Sk - Sq), the last query lines up with the last key
+static inline int visible_keys(int i, int Sq, int Sk, bool causal) {
+    return causal ? std::min(Sk, i + 1 + Sk - Sq) : Sk;
+}
+
+// === FORWARD ===
+
+namespace {
+
+// Where the forward reads keys and values: span(j, &k, &v) points k / v at
+// key row j and returns how many rows from there are contiguous (ldk / ldv
+// apart), key tiles are cut to that
+
+// One contiguous buffer each
+struct DenseKeys {
+    const float* K; const float* V;
+    int ldk, ldv;
+
+    int span(int j, const float** k, const float** v) const {
+        *k = K + (size_t)j * ldk;
+        *v = V + (size_t)j * ldv;
+        return ATTN_BLOCK_K;
+    }
+};
+
+// Pages of a KVPagePool, through a page table
+struct PagedKeys {
+    const float* K; const float* V;
+    int ldk, ldv;
+    size_t page_stride;
+    const int* pages;
+    int page_size;
+
+    int span(int j, const float** k, const float** v) const {
+        size_t at = (size_t)pages[j / page_size] * page_stride + (size_t)(j % page_size) * ldk;
+        *k = K + at;
+        *v = V + at;
+        return page_size - j % page_size;
+    }
+};
+
+template <class Keys>
+void forward_impl(int Sq, int Sk, int d, float scale, bool causal,
+                  const float* Q, int ldq, const Keys& keys, float* O, int ldo, float* lse) {
+    assert(!causal || Sq <= Sk);
+    int ldk = keys.ldk, ldv = keys.ldv;
+    int q_blocks = (Sq + ATTN_BLOCK_Q - 1) / ATTN_BLOCK_Q;
+
+    // Query blocks are independent, each owns its rows of O and lse
+    parallel_for(q_blocks, 1, [&](int64_t begin, int64_t end) {
+        const KernelTable& k = kernels();
+        float s[ATTN_BLOCK_Q * ATTN_BLOCK_K]; // scores, then probabilities of one tile
+        float m[ATTN_BLOCK_Q];                // running row max
+        float l[ATTN_BLOCK_Q];                // running row sum of exp(s - m)
+
+        for (int64_t qb = begin; qb < end; qb++) {
+            int i0 = (int)qb * ATTN_BLOCK_Q;
+            int bq = std::min(ATTN_BLOCK_Q, Sq - i0);
+            float* o = O + (size_t)i0 * ldo; // accumulates the unnormalized output
+
+            for (int r = 0; r < bq; r++) {
+                m[r] = -INFINITY;
+                l[r] = 0.0f;
+                std::fill(o + (size_t)r * ldo, o + (size_t)r * ldo + d, 0.0f);
+            }
+
+            // Key tiles past the block's last visible key are fully masked
+            int k_end = visible_keys(i0 + bq - 1, Sq, Sk, causal);
+            for (int j0 = 0, bk; j0 < k_end; j0 += bk) {
+                // A tile never straddles a page
+                const float* K;
+                const float* V;
+                bk = std::min(std::min(ATTN_BLOCK_K, k_end - j0), keys.span(j0, &K, &V));
+
+                // S = scale * Q_i @ K_j^T
+                gemm(false, true, bq, bk, d,
+                     scale, Q + (size_t)i0 * ldq, ldq, K, ldk,
+                     0.0f, s, bk);
+
+                // Online softmax: move each row to the new max, rescale what
+                // was accumulated under the old one. On the diagonal tile a
+                // row only covers its first n keys, the rest gets P = 0
+                for (int r = 0; r < bq; r++) {
+                    float* sr = s + r * bk;
+                    int n = std::max(0, std::min(bk, visible_keys(i0 + r, Sq, Sk, causal) - j0));
+                    std::fill(sr + n, sr + bk, 0.0f);
+                    if (n == 0) continue;
+
+                    float m_new = std::max(m[r], k.max(sr, n));
+                    float correction = std::exp(m[r] - m_new); // 0 on the first tile
+                    l[r] = l[r] * correction + k.exp_shift(sr, m_new, sr, n);
+                    if (correction != 1.0f) k.scale(correction, o + (size_t)r * ldo, d);
+                    m[r] = m_new;
+                }
+
+                // O_i += P @ V_j
+                gemm(false, false, bq, d, bk,
+                     1.0f, s, bk, V, ldv,
+                     1.0f, o, ldo);
+            }
+
+            for (int r = 0; r < bq; r++) {
+                k.scale(1.0f / l[r], o + (size_t)r * ldo, d);
+                if (lse) lse[i0 + r] = m[r] + std::log(l[r]);
+            }
+        }
+    });
+}
+
+} // namespace
+
+void attention_forward(int Sq, int Sk, int d, float scale, bool causal,
+                       const float* Q, int ldq, const float* K, int ldk,
+                       const float* V, int ldv, float* O, int ldo, float* lse) {
+    forward_impl(Sq, Sk, d, scale, causal, Q, ldq, DenseKeys{K, V, ldk, ldv}, O, ldo, lse);
+}
+
+void paged_attention_forward(int Sq, int Sk, int d, float scale, bool causal,
+                             const float* Q, int ldq, const float* K, const float* V, int ldkv,
+                             size_t page_stride, const int* pages, int page_size,
+                             float* O, int ldo, float* lse) {
+    forward_impl(Sq, Sk, d, scale, causal, Q, ldq,
+                 PagedKeys{K, V, ldkv, ldkv, page_stride, pages, page_size}, O, ldo, lse);
+}
+
+void grouped_attention_forward(int Sq, int Sk, int num_heads, int num_kv_heads, int d,
+                               float scale, bool causal,
+                               const float* Q, int ldq, const float* K, int ldk,
+                               const float* V, int ldv, float* O, int ldo, float* lse) {
+    assert(num_kv_heads > 0 && num_heads % num_kv_heads == 0);
+    int group = num_heads / num_kv_heads;
+    parallel_for(num_heads, 1, [&](int64_t begin, int64_t end) {
+        for (int64_t h = begin; h < end; h++) {
+            size_t kv = (size_t)(h / group) * d;
+            attention_forward(Sq, Sk, d, scale, causal,
+                              Q + h * d, ldq, K + kv, ldk, V + kv, ldv,
+                              O + h * d, ldo, lse ? lse + h * Sq : nullptr);
+        }
+    });
+}
+
+// === BACKWARD ===
+
+namespace {
+
+struct BackwardArgs {
+    int Sq, Sk, d;
+    float scale;
+    bool causal;
+    const float* Q; int ldq;
+    const float* K; int ldk;
+    const float* V; int ldv;
+    const float* dO; int ldo;
+    const float* lse;
+    const float* D; // rowsum(dO * O)
+};
+
+// For the tile (query rows i0.., key rows j0..) recompute the probabilities
+// P = exp(scale * Q_i K_j^T - lse_i) and the score gradient
+// dS = P * (dO_i V_j^T - D_i), both [bq, bk]. Masked entries get P = dS = 0
+void backward_tile(const BackwardArgs& a, int i0, int bq, int j0, int bk, float* p, float* ds) {
+    const KernelTable& k = kernels();
+
+    gemm(false, true, bq, bk, a.d,
+         a.scale, a.Q + (size_t)i0 * a.ldq, a.ldq, a.K + (size_t)j0 * a.ldk, a.ldk,
+         0.0f, p, bk);
+    for (int r = 0; r < bq; r++) {
+        float* pr = p + r * bk;
+        int n = std::max(0, std::min(bk, visible_keys(i0 + r, a.Sq, a.Sk, a.causal) - j0));
+        k.exp_shift(pr, a.lse[i0 + r], pr, n);
+        std::fill(pr + n, pr + bk, 0.0f);
+    }
+
+    gemm(false, true, bq, bk, a.d,
+         1.0f, a.dO + (size_t)i0 * a.ldo, a.ldo, a.V + (size_t)j0 * a.ldv, a.ldv,
+         0.0f, ds, bk);
+    for (int r = 0; r < bq; r++) k.softmax_grad(p + r * bk, a.D[i0 + r], ds + r * bk, bk);
+}
+
+} // namespace
+
+void attention_backward(int Sq, int Sk, int d, float scale, bool causal,
+                        const float* Q, int ldq, const float* K, int ldk,
+                        const float* V, int ldv, const float* O, const float* dO, int ldo,
+                        const float* lse, float* dQ, float* dK, float* dV) {
+    if (!dQ && !dK && !dV) return;
+
+    FloatBuffer D(TensorAllocator<float>(GraphArena::current()));
+    D.resize(Sq);
+    for (int i = 0; i < Sq; i++) D[i] = kernels().dot(dO + (size_t)i * ldo, O + (size_t)i * ldo, d);
+
+    BackwardArgs a = {Sq, Sk, d, scale, causal, Q, ldq, K, ldk, V, ldv, dO, ldo, lse, D.data()};
+    int q_blocks = (Sq + ATTN_BLOCK_Q - 1) / ATTN_BLOCK_Q;
+    int k_blocks = (Sk + ATTN_BLOCK_K - 1) / ATTN_BLOCK_K;
+
+    // Key blocks own their rows of dK / dV. dQ rows are shared by every key
+    // block, so they get their own pass over query blocks, unless the key
+    // loop runs on one thread anyway
+    bool dq_in_key_pass = dQ && (k_blocks == 1 || ThreadPool::instance().num_threads() <= 1 ||
+                                 ThreadPool::in_parallel());
+
+    if (dK || dV || dq_in_key_pass) {
+        parallel_for(k_blocks, 1, [&](int64_t begin, int64_t end) {
+            float p[ATTN_BLOCK_Q * ATTN_BLOCK_K];
+            float ds[ATTN_BLOCK_Q * ATTN_BLOCK_K];
+            for (int64_t kb = begin; kb < end; kb++) {
+                int j0 = (int)kb * ATTN_BLOCK_K;
+                int bk = std::min(ATTN_BLOCK_K, Sk - j0);
+                for (int i0 = 0; i0 < Sq; i0 += ATTN_BLOCK_Q) {
+                    int bq = std::min(ATTN_BLOCK_Q, Sq - i0);
+                    if (visible_keys(i0 + bq - 1, Sq, Sk, causal) <= j0) continue; // fully masked
+                    backward_tile(a, i0, bq, j0, bk, p, ds);
+
+                    // dV_j += P^T @ dO_i
+                    if (dV) gemm(true, false, bk, d, bq, 1.0f, p, bk, dO + (size_t)i0 * ldo, ldo,
+                                 1.0f, dV + (size_t)j0 * ldv, ldv);
+                    // dK_j += scale * dS^T @ Q_i
+                    if (dK) gemm(true, false, bk, d, bq, scale, ds, bk, Q + (size_t)i0 * ldq, ldq,
+                                 1.0f, dK + (size_t)j0 * ldk, ldk);
+                    // dQ_i += scale * dS @ K_j
+                    if (dq_in_key_pass) gemm(false, false, bq, d, bk, scale, ds, bk, K + (size_t)j0 * ldk, ldk,
+                                             1.0f, dQ + (size_t)i0 * ldq, ldq);
+                }
+            }
+        });
+    }
+
+    if (dQ && !dq_in_key_pass) {
+        parallel_for(q_blocks, 1, [&](int64_t begin, int64_t end) {
+            float p[ATTN_BLOCK_Q * ATTN_BLOCK_K];
+            float ds[ATTN_BLOCK_Q * ATTN_BLOCK_K];
+            for (int64_t qb = begin; qb < end; qb++) {
+                int i0 = (int)qb * ATTN_BLOCK_Q;
+                int bq = std::min(ATTN_BLOCK_Q, Sq - i0);
+                int k_end = visible_keys(i0 + bq - 1, Sq, Sk, causal);
+                for (int j0 = 0; j0 < k_end; j0 += ATTN_BLOCK_K) {
+                    int bk = std::min(ATTN_BLOCK_K, k_end - j0);
+                    backward_tile(a, i0, bq, j0, bk, p, ds);
+                    gemm(false, false, bq, d, bk, scale, ds, bk, K + (size_t)j0 * ldk, ldk,
+                         1.0f, dQ + (size_t)i0 * ldq, ldq);
+                }
+            }
+        });
+    }
+}
+
+// === AUTOGRAD OP ===
+
+TensorPtr attention(TensorPtr Q, TensorPtr K, TensorPtr V, float scale, bool causal) {
+    assert(Q->cols == K->cols && K->rows == V->rows && V->cols == Q->cols);
+    assert(!causal || Q->rows <= K->rows);
+
+    // Rows are read with unit stride, any row stride is fine
+    if (Q->col_stride != 1 && Q->cols > 1) Q = contiguous(Q);
+    if (K->col_stride != 1 && K->cols > 1) K = contiguous(K);
+    if (V->col_stride != 1 && V->cols > 1) V = contiguous(V);
+
+    int Sq = Q->rows, Sk = K->rows, d = Q->cols;
+    TensorPtr out = Tensor::empty(Sq, d);
+
+    // Per-row log-sum-exp, all the backward keeps besides the inputs
+    FloatBuffer lse(TensorAllocator<float>(GraphArena::current()));
+    lse.resize(Sq);
+    attention_forward(Sq, Sk, d, scale, causal,
+                      Q->ptr(), Q->row_stride, K->ptr(), K->row_stride,
+                      V->ptr(), V->row_stride, out->data.data(), d, lse.data());
+
+    if (out->track({Q, K, V})) {
+        out->_backward = [Q = Q.get(), K = K.get(), V = V.get(), out = out.get(),
+                          scale, causal, lse = std::move(lse)]() {
+            attention_backward(Q->rows, K->rows, Q->cols, scale, causal,
+                               Q->ptr(), Q->row_stride, K->ptr(), K->row_stride,
+                               V->ptr(), V->row_stride, out->data.data(), out->grad.data(), Q->cols,
+                               lse.data(),
+                               Q->requires_grad ? Q->grad_data() : nullptr,
+                               K->requires_grad ? K->grad_data() : nullptr,
+                               V->requires_grad ? V->grad_data() : nullptr);
+        };
+    }
+
+    return out;
+}
+
+TensorPtr multi_head_attention(TensorPtr qkv, int num_heads, int num_kv_heads,
+                               float scale, bool causal) {
+    return multi_head_attention(qkv, num_heads, num_kv_heads, scale, causal, {0, qkv->rows});
+}
+
+TensorPtr multi_head_attention(TensorPtr qkv, int num_heads, int num_kv_heads,
+                               float scale, bool causal, const std::vector<int>& offsets) {
+    assert(num_kv_heads > 0 && num_heads % num_kv_heads == 0);
+    assert(qkv->cols % (num_heads + 2 * num_kv_heads) == 0);
+    assert(offsets.size() >= 2 && offsets.front() == 0 && offsets.back() == qkv->rows);
+    if (qkv->col_stride != 1 && qkv->cols > 1) qkv = contiguous(qkv);
+
+    int S = qkv->rows;
+    int batch = (int)offsets.size() - 1;
+    int d = qkv->cols / (num_heads + 2 * num_kv_heads);
+    int group = num_heads / num_kv_heads;
+    TensorPtr out = Tensor::empty(S, num_heads * d);
+
+    // Head h of row r at lse[h * S + r], sequences keep their packed rows
+    FloatBuffer lse(TensorAllocator<float>(GraphArena::current()));
+    lse.resize((size_t)num_heads * S);
+
+    // The Q, K and V sections of a qkv row
+    const float* x = qkv->ptr();
+    const float* k = x + (size_t)num_heads * d;
+    const float* v = k + (size_t)num_kv_heads * d;
+    int ld = qkv->row_stride;
+    int ldo = num_heads * d;
+
+    // One task per (sequence, query head), each sees only its own rows
+    parallel_for((int64_t)batch * num_heads, 1, [&](int64_t begin, int64_t end) {
+        for (int64_t t = begin; t < end; t++) {
+            int b = (int)(t / num_heads), h = (int)(t % num_heads);
+            int r0 = offsets[b], n = offsets[b + 1] - r0;
+            if (n == 0) continue;
+            size_t row = (size_t)r0 * ld, kv = (size_t)(h / group) * d;
+            attention_forward(n, n, d, scale, causal,
+                              x + row + h * d, ld, k + row + kv, ld, v + row + kv, ld,
+                              out->data.data() + (size_t)r0 * ldo + h * d, ldo,
+                              lse.data() + (size_t)h * S + r0);
+        }
+    });
+
+    if (out->track({qkv})) {
+        out->_backward = [qkv = qkv.get(), out = out.get(), num_heads, num_kv_heads, d, scale, causal,
+                          offsets, lse = std::move(lse)]() {
+            if (!qkv->requires_grad) return;
+            int S = qkv->rows;
+            int batch = (int)offsets.size() - 1;
+            int group = num_heads / num_kv_heads;
+            size_t k_base = (size_t)num_heads * d;
+            size_t v_base = k_base + (size_t)num_kv_heads * d;
+            int ld = qkv->row_stride;
+            int ldo = num_heads * d;
+            const float* x = qkv->ptr();
+            float* dx = qkv->grad_data();
+
+            // One task per (sequence, K/V head), its query heads run in turn
+            // so dK / dV have a single writer
+            parallel_for((int64_t)batch * num_kv_heads, 1, [&](int64_t begin, int64_t end) {
+                for (int64_t t = begin; t < end; t++) {
+                    int b = (int)(t / num_kv_heads), g = (int)(t % num_kv_heads);
+                    int r0 = offsets[b], n = offsets[b + 1] - r0;
+                    if (n == 0) continue;
+                    size_t row = (size_t)r0 * ld, kv = (size_t)g * d;
+                    const float* o = out->data.data() + (size_t)r0 * ldo;
+                    const float* dO = out->grad.data() + (size_t)r0 * ldo;
+                    for (int h = g * group; h < (g + 1) * group; h++) {
+                        attention_backward(n, n, d, scale, causal,
+                                           x + row + h * d, ld, x + row + k_base + kv, ld,
+                                           x + row + v_base + kv, ld,
+                                           o + h * d, dO + h * d, ldo,
+                                           lse.data() + (size_t)h * S + r0,
+                                           dx + row + h * d, dx + row + k_base + kv,
+                                           dx + row + v_base + kv);
+                    }
+                }
+            });
+        };
+    }
+
+    return out;
+}
@@ -0,0 +1,147 @@
+#include "../include/beam_search.h"
+#include <cassert>
+#include <algorithm>
+#include <cmath>
+
+struct Beam {
+    KVCache cache; // holds prompt + tokens except the newest one
+    std::vector<int> tokens;
+    float log_prob;
+};
+
+static float length_score(float log_prob, int length, float penalty) {
+    return log_prob / std::pow((float)std::max(length, 1), penalty);
+}
+
+static bool better(const BeamHypothesis& a, const BeamHypothesis& b) {
+    return a.score > b.score;
+}
+
+// Adds h to the best `width` hypotheses, kept sorted best first
+static void keep_best(std::vector<BeamHypothesis>& finished, BeamHypothesis h, int width) {
+    finished.insert(std::upper_bound(finished.begin(), finished.end(), h, better), std::move(h));
+    if ((int)finished.size() > width) finished.pop_back();
+}
+
+std::vector<BeamHypothesis> beam_search(GPT& model, const std::vector<int>& prompt, int max_new_tokens,
+                                        const BeamSearchConfig& config) {
+    int B = config.beam_width;
+    int V = model.vocab_size;
+    int P = (int)prompt.size();
+    assert(B > 0 && P > 0 && P <= model.max_seq_len);
+    std::vector<BeamHypothesis> finished;
+    // The last token of a hypothesis is never fed, so the context can end
+    // one past max_seq_len
+    max_new_tokens = std::min(max_new_tokens, model.max_seq_len - P + 1);
+    if (max_new_tokens <= 0) return finished;
+
+    // Prompt pages are shared by every beam, each beam owns at most its
+    // generated positions plus one copied page where it branched
+    int ps = KV_PAGE_SIZE;
+    int own_pages = (max_new_tokens + ps - 1) / ps + 1;
+    auto pool = model.make_page_pool((P + ps - 1) / ps + B * own_pages, ps);
+
+    std::vector<Beam> beams;
+    beams.push_back(Beam{model.make_cache(pool), {}, 0.0f});
+
+    std::vector<std::pair<float, int>> candidates; // (log_prob, beam * V + token)
+    std::vector<int> tokens, offsets, children;
+    std::vector<KVCache*> caches;
+    std::vector<Beam> next;
+    GraphArena arena;
+    bool stopped = false; // the stopping rule ended the search
+
+    for (int step = 0; step < max_new_tokens && !stopped; step++) {
+        int n = (int)beams.size();
+
+        // Every live beam feeds its newest token (the first step, the prompt)
+        tokens.clear();
+        offsets.assign(1, 0);
+        caches.clear();
+        for (Beam& beam : beams) {
+            if (step == 0) {
+                tokens.insert(tokens.end(), prompt.begin(), prompt.end());
+            } else {
+                tokens.push_back(beam.tokens.back());
+            }
+            offsets.push_back((int)tokens.size());
+            caches.push_back(&beam.cache);
+        }
+
+        candidates.resize((size_t)n * V);
+        {
+            GraphArena::Scope scope(arena);
+            TensorPtr logits = model.forward_batch_cached(tokens, offsets, caches);
+            for (int b = 0; b < n; b++) {
+                const float* row = logits->ptr() + (size_t)b * logits->row_stride;
+                float max_logit = *std::max_element(row, row + V);
+                float sum = 0.0f;
+                for (int t = 0; t < V; t++) sum += std::exp(row[t] - max_logit);
+                float base = beams[b].log_prob - max_logit - std::log(sum);
+                for (int t = 0; t < V; t++) candidates[(size_t)b * V + t] = std::make_pair(base + row[t], b * V + t);
+            }
+        }
+
+        // 2 * B best extensions: even if B of them stop, B stay live
+        int top = std::min(2 * B, n * V);
+        std::partial_sort(candidates.begin(), candidates.begin() + top, candidates.end(),
+                          [](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+                              return a.first > b.first;
+                          });
+
+        int live = 0;
+        children.assign(n, 0);
+        for (int i = 0; i < top && live < B; i++) {
+            int b = candidates[i].second / V, t = candidates[i].second % V;
+            if (t == config.stop_token) {
+                BeamHypothesis h;
+                h.tokens = beams[b].tokens;
+                h.tokens.push_back(t);
+                h.log_prob = candidates[i].first;
+                h.score = length_score(h.log_prob, (int)h.tokens.size(), config.length_penalty);
+                keep_best(finished, std::move(h), B);
+                candidates[i].second = -1; // not extended
+            } else {
+                children[b]++;
+                live++;
+            }
+        }
+
+        // A parent's last extension takes its cache over, the others fork it
+        next.clear();
+        for (int i = 0; i < top && (int)next.size() < live; i++) {
+            if (candidates[i].second < 0) continue;
+            int b = candidates[i].second / V, t = candidates[i].second % V;
+            Beam& parent = beams[b];
+            KVCache cache = --children[b] == 0 ? std::move(parent.cache) : parent.cache.fork();
+            std::vector<int> beam_tokens = parent.tokens;
+            beam_tokens.push_back(t);
+            next.push_back(Beam{std::move(cache), std::move(beam_tokens), candidates[i].first});
+        }
+        beams.swap(next); // old beams drop their page references
+
+        if (beams.empty()) break;
+        if ((int)finished.size() == B) {
+            if (config.early_stopping) {
+                stopped = true;
+            } else {
+                float best = -INFINITY;
+                for (const Beam& beam : beams)
+                    best = std::max(best, length_score(beam.log_prob, (int)beam.tokens.size(), config.length_penalty));
+                stopped = best <= finished.back().score;
+            }
+        }
+    }
+    if (stopped) return finished;
+
+    // Out of steps (max_new_tokens or max_seq_len): beams still live are
+    // cut off there and compete as they are
+    for (Beam& beam : beams) {
+        BeamHypothesis h;
+        h.log_prob = beam.log_prob;
+        h.score = length_score(beam.log_prob, (int)beam.tokens.size(), config.length_penalty);
+        h.tokens = std::move(beam.tokens);
+        keep_best(finished, std::move(h), B);
+    }
+    return finished;
+}
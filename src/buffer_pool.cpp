@@ -0,0 +1,79 @@
+#include "../include/buffer_pool.h"
+#include <new>
+
+static const int MIN_SHIFT = 6; // smallest class: 64 bytes, one TENSOR_ALIGNMENT line
+
+// Round up to the size class, 4 classes per doubling above 64 bytes
+static size_t size_class(size_t bytes, size_t* index) {
+    if (bytes <= ((size_t)1 << MIN_SHIFT)) {
+        *index = 0;
+        return (size_t)1 << MIN_SHIFT;
+    }
+    int k = 63 - __builtin_clzll((unsigned long long)(bytes - 1)); // 2^k < bytes <= 2^(k+1)
+    size_t step = (size_t)1 << (k - 2);
+    size_t rounded = (bytes + step - 1) & ~(step - 1);
+    *index = 1 + (size_t)(k - MIN_SHIFT) * 4 + (rounded >> (k - 2)) - 5;
+    return rounded;
+}
+
+BufferPool& BufferPool::instance() {
+    // Never destroyed, tensors in static storage may outlive any static pool
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
+
+void* BufferPool::allocate(size_t bytes) {
+    size_t index;
+    size_t size = size_class(bytes, &index);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.bytes_in_use += size;
+        if (index < free_lists_.size() && !free_lists_[index].empty()) {
+            void* p = free_lists_[index].back();
+            free_lists_[index].pop_back();
+            stats_.hits++;
+            stats_.bytes_cached -= size;
+            return p;
+        }
+        stats_.misses++;
+        size_t held = stats_.bytes_in_use + stats_.bytes_cached;
+        if (held > stats_.high_water) stats_.high_water = held;
+    }
+
+    return ::operator new(size, std::align_val_t(TENSOR_ALIGNMENT));
+}
+
+void BufferPool::deallocate(void* p, size_t bytes) {
+    if (!p) return;
+    size_t index;
+    size_t size = size_class(bytes, &index);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index >= free_lists_.size()) free_lists_.resize(index + 1);
+    free_lists_[index].push_back(p);
+    stats_.bytes_in_use -= size;
+    stats_.bytes_cached += size;
+}
+
+BufferPool::Stats BufferPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void BufferPool::reset_stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.hits = 0;
+    stats_.misses = 0;
+    stats_.high_water = stats_.bytes_in_use + stats_.bytes_cached;
+}
+
+void BufferPool::trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& list : free_lists_) {
+        for (void* p : list) ::operator delete(p, std::align_val_t(TENSOR_ALIGNMENT));
+        list.clear();
+        list.shrink_to_fit();
+    }
+    stats_.bytes_cached = 0;
+}
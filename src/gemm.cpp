@@ -0,0 +1,174 @@
+#include "../include/gemm.h"
+#include "../include/arena.h"
+#include "../include/kernels.h"
+#include "../include/thread_pool.h"
+#include <vector>
+#include <algorithm>
+
+/**
+ * Classic Goto-style blocking:
+ *      NC columns of B are split into KC x NC panels (fit in L3/L2)
+ *      MC rows of A are split into MC x KC panels (fit in L2)
+ *      The micro kernel computes an MR x NR tile of C in registers
+ *      (scalar / AVX2 / AVX-512 version picked in kernels.cpp)
+ *
+ * Both panels are packed into contiguous buffers first, so the micro kernel
+ * only ever streams through memory with unit stride, no matter how A and B
+ * are laid out (or transposed) in the original tensors.
+ *
+ * Large blocks are spread over the thread pool: B panels are packed in
+ * parallel, then each task packs its own A block and fills a disjoint
+ * region of C, so no synchronization is needed inside a block. On the
+ * last K block the task also runs the epilogue (bias, activation) on
+ * its region.
+ */
+static const int MR = GEMM_MR;
+static const int NR = GEMM_NR;
+static const int MC = 96;   // multiple of MR
+static const int KC = 256;
+static const int NC = 2048; // multiple of NR
+
+// M * nc * kc multiply-adds below which a block stays on one thread
+static const double GEMM_PARALLEL_WORK = 128.0 * 1024;
+
+// Pack op(A)[ic:ic+mc, pc:pc+kc] into MR-row panels, zero padded
+static void pack_a(bool trans, const float* A, int lda, int ic, int pc,
+                   int mc, int kc, float* buf) {
+    for (int ir = 0; ir < mc; ir += MR) {
+        int mr = std::min(MR, mc - ir);
+        for (int p = 0; p < kc; p++) {
+            for (int i = 0; i < mr; i++) {
+                int row = ic + ir + i;
+                int col = pc + p;
+                buf[i] = trans ? A[(size_t)col * lda + row] : A[(size_t)row * lda + col];
+            }
+            for (int i = mr; i < MR; i++) buf[i] = 0.0f;
+            buf += MR;
+        }
+    }
+}
+
+// Pack op(B)[pc:pc+kc, jc:jc+nc] into NR-column panels, zero padded
+static void pack_b(bool trans, const float* B, int ldb, int pc, int jc,
+                   int kc, int nc, float* buf) {
+    for (int jr = 0; jr < nc; jr += NR) {
+        int nr = std::min(NR, nc - jr);
+        for (int p = 0; p < kc; p++) {
+            int row = pc + p;
+            if (!trans) {
+                const float* src = B + (size_t)row * ldb + jc + jr;
+                for (int j = 0; j < nr; j++) buf[j] = src[j];
+            } else {
+                for (int j = 0; j < nr; j++) buf[j] = B[(size_t)(jc + jr + j) * ldb + row];
+            }
+            for (int j = nr; j < NR; j++) buf[j] = 0.0f;
+            buf += NR;
+        }
+    }
+}
+
+// C[i0:i1, j0:j1] = act(C + bias)
+static void apply_epilogue(const GemmEpilogue& ep, float* C, int ldc,
+                           int i0, int i1, int j0, int j1) {
+    const KernelTable& k = kernels();
+    size_t n = j1 - j0;
+    for (int i = i0; i < i1; i++) {
+        float* c = C + (size_t)i * ldc + j0;
+        if (ep.bias) k.axpy(1.0f, ep.bias + j0, c, n);
+        if (ep.pre_act) std::copy(c, c + n, ep.pre_act + (size_t)i * ep.ld_pre + j0);
+        if (ep.act != Activation::None) activation_forward(ep.act, c, c, n);
+    }
+}
+
+void gemm(bool trans_a, bool trans_b, int M, int N, int K,
+          float alpha, const float* A, int lda,
+          const float* B, int ldb,
+          float beta, float* C, int ldc,
+          const GemmEpilogue* epilogue) {
+    if (M <= 0 || N <= 0) return;
+
+    // Apply beta once up front, the kernels below only accumulate
+    if (beta != 1.0f) {
+        for (int i = 0; i < M; i++) {
+            float* c_row = C + (size_t)i * ldc;
+            if (beta == 0.0f) {
+                std::fill(c_row, c_row + N, 0.0f);
+            } else {
+                for (int j = 0; j < N; j++) c_row[j] *= beta;
+            }
+        }
+    }
+    if (K <= 0 || alpha == 0.0f) {
+        if (epilogue) apply_epilogue(*epilogue, C, ldc, 0, M, 0, N);
+        return;
+    }
+
+    const KernelTable& k = kernels();
+    int threads = ThreadPool::instance().num_threads();
+    // Aligned (pool) buffers: every NR-wide B row is one cache line
+    thread_local std::vector<float, TensorAllocator<float>> b_buf;
+
+    for (int jc = 0; jc < N; jc += NC) {
+        int nc = std::min(NC, N - jc);
+        int n_panels = (nc + NR - 1) / NR;
+
+        for (int pc = 0; pc < K; pc += KC) {
+            int kc = std::min(KC, K - pc);
+
+            // Only split the work once the block is worth waking threads for
+            bool parallel = threads > 1 && (double)M * nc * kc >= GEMM_PARALLEL_WORK;
+            bool last_k = pc + kc >= K;
+
+            b_buf.resize((size_t)kc * n_panels * NR);
+            float* b_packed = b_buf.data();
+            parallel_for(n_panels, parallel ? 1 : n_panels, [&](int64_t p0, int64_t p1) {
+                int cols = std::min(nc, (int)p1 * NR) - (int)p0 * NR;
+                pack_b(trans_b, B, ldb, pc, jc + (int)p0 * NR, kc, cols, b_packed + (size_t)p0 * NR * kc);
+            });
+
+            // Task grid over (MC row block, group of NR panels). Skinny outputs
+            // (few rows, wide N, e.g. output_head) are split along N instead
+            int n_ic = (M + MC - 1) / MC;
+            int n_jn = 1;
+            if (parallel && n_ic < 2 * threads) {
+                n_jn = std::min(n_panels, (2 * threads + n_ic - 1) / n_ic);
+            }
+            int panels_per_task = (n_panels + n_jn - 1) / n_jn;
+            int n_tasks = n_ic * n_jn;
+
+            parallel_for(n_tasks, parallel ? 1 : n_tasks, [&](int64_t t0, int64_t t1) {
+                thread_local std::vector<float, TensorAllocator<float>> a_buf;
+
+                for (int64_t t = t0; t < t1; t++) {
+                    int ic = (int)(t / n_jn) * MC;
+                    int mc = std::min(MC, M - ic);
+                    int p_begin = (int)(t % n_jn) * panels_per_task;
+                    int p_end = std::min(n_panels, p_begin + panels_per_task);
+                    if (p_begin >= p_end) continue;
+
+                    a_buf.resize((size_t)((mc + MR - 1) / MR * MR) * kc);
+                    pack_a(trans_a, A, lda, ic, pc, mc, kc, a_buf.data());
+
+                    for (int p = p_begin; p < p_end; p++) {
+                        int jr = p * NR;
+                        int nr = std::min(NR, nc - jr);
+                        const float* b_panel = b_packed + (size_t)jr * kc;
+
+                        for (int ir = 0; ir < mc; ir += MR) {
+                            int mr = std::min(MR, mc - ir);
+                            const float* a_panel = a_buf.data() + (size_t)ir * kc;
+                            float* c_tile = C + (size_t)(ic + ir) * ldc + jc + jr;
+                            k.gemm_micro(kc, a_panel, b_panel, c_tile, ldc, mr, nr, alpha);
+                        }
+                    }
+
+                    // This task's region of C is final, finish it while it's hot
+                    if (epilogue && last_k) {
+                        apply_epilogue(*epilogue, C, ldc, ic, ic + mc,
+                                       jc + p_begin * NR, jc + std::min(nc, p_end * NR));
+                    }
+                }
+            });
+        }
+    }
+}
@@ -0,0 +1,310 @@
+#include "../include/kernels.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+// === SCALAR KERNELS ===
+// Reference implementations, also the fallback on CPUs without AVX2
+
+static void add_scalar(const float* a, const float* b, float* y, size_t n) {
+    for (size_t i = 0; i < n; i++) y[i] = a[i] + b[i];
+}
+
+static void sub_scalar(const float* a, const float* b, float* y, size_t n) {
+    for (size_t i = 0; i < n; i++) y[i] = a[i] - b[i];
+}
+
+static void mul_scalar(const float* a, const float* b, float* y, size_t n) {
+    for (size_t i = 0; i < n; i++) y[i] = a[i] * b[i];
+}
+
+static void relu_scalar(const float* x, float* y, size_t n) {
+    for (size_t i = 0; i < n; i++) y[i] = std::max(0.0f, x[i]);
+}
+
+static void tanh_scalar(const float* x, float* y, size_t n) {
+    for (size_t i = 0; i < n; i++) y[i] = std::tanh(x[i]);
+}
+
+static void sigmoid_scalar(const float* x, float* y, size_t n) {
+    for (size_t i = 0; i < n; i++) y[i] = 1.0f / (1.0f + std::exp(-x[i]));
+}
+
+static const float GELU_C = 0.7978845608f; // sqrt(2 / pi)
+static const float GELU_A = 0.044715f;
+
+static void gelu_scalar(const float* x, float* y, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        float v = x[i];
+        y[i] = 0.5f * v * (1.0f + std::tanh(GELU_C * (v + GELU_A * v * v * v)));
+    }
+}
+
+static float gelu_derivative(float v) {
+    float t = std::tanh(GELU_C * (v + GELU_A * v * v * v));
+    return 0.5f * (1.0f + t) + 0.5f * v * (1.0f - t * t) * GELU_C * (1.0f + 3.0f * GELU_A * v * v);
+}
+
+static void exp_scalar(const float* x, float* y, size_t n) {
+    for (size_t i = 0; i < n; i++) y[i] = std::exp(x[i]);
+}
+
+static void axpy_scalar(float alpha, const float* x, float* dx, size_t n) {
+    for (size_t i = 0; i < n; i++) dx[i] += alpha * x[i];
+}
+
+static void scale_scalar(float alpha, float* x, size_t n) {
+    for (size_t i = 0; i < n; i++) x[i] *= alpha;
+}
+
+static void mul_acc_scalar(const float* a, const float* b, float* dx, size_t n) {
+    for (size_t i = 0; i < n; i++) dx[i] += a[i] * b[i];
+}
+
+static void diff_acc_scalar(float alpha, const float* a, const float* b, float* dx, size_t n) {
+    for (size_t i = 0; i < n; i++) dx[i] += alpha * (a[i] - b[i]);
+}
+
+static void relu_backward_scalar(const float* x, const float* dy, float* dx, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (x[i] > 0) dx[i] += dy[i];
+    }
+}
+
+static void tanh_backward_scalar(const float* y, const float* dy, float* dx, size_t n) {
+    for (size_t i = 0; i < n; i++) dx[i] += (1.0f - y[i] * y[i]) * dy[i];
+}
+
+static void sigmoid_backward_scalar(const float* y, const float* dy, float* dx, size_t n) {
+    for (size_t i = 0; i < n; i++) dx[i] += y[i] * (1.0f - y[i]) * dy[i];
+}
+
+static void gelu_backward_scalar(const float* x, const float* dy, float* dx, size_t n) {
+    for (size_t i = 0; i < n; i++) dx[i] += gelu_derivative(x[i]) * dy[i];
+}
+
+static void relu_grad_scalar(const float* y, float* g, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (!(y[i] > 0)) g[i] = 0.0f;
+    }
+}
+
+static void tanh_grad_scalar(const float* y, float* g, size_t n) {
+    for (size_t i = 0; i < n; i++) g[i] *= 1.0f - y[i] * y[i];
+}
+
+static void sigmoid_grad_scalar(const float* y, float* g, size_t n) {
+    for (size_t i = 0; i < n; i++) g[i] *= y[i] * (1.0f - y[i]);
+}
+
+static void gelu_grad_scalar(const float* x, float* g, size_t n) {
+    for (size_t i = 0; i < n; i++) g[i] *= gelu_derivative(x[i]);
+}
+
+static void softmax_row_scalar(const float* x, float* y, size_t n) {
+    float max_val = -INFINITY;
+    for (size_t i = 0; i < n; i++) max_val = std::max(max_val, x[i]);
+
+    float sum_exp = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        y[i] = std::exp(x[i] - max_val);
+        sum_exp += y[i];
+    }
+
+    float inv = 1.0f / sum_exp;
+    for (size_t i = 0; i < n; i++) y[i] *= inv;
+}
+
+static void softmax_row_backward_scalar(const float* y, const float* dy, float* dx, size_t n) {
+    float dot = 0.0f;
+    for (size_t i = 0; i < n; i++) dot += y[i] * dy[i];
+    for (size_t i = 0; i < n; i++) dx[i] += y[i] * (dy[i] - dot);
+}
+
+static float sumexp_row_scalar(const float* x, size_t n, float* max_out) {
+    float max_val = -INFINITY;
+    for (size_t i = 0; i < n; i++) max_val = std::max(max_val, x[i]);
+
+    float sum_exp = 0.0f;
+    for (size_t i = 0; i < n; i++) sum_exp += std::exp(x[i] - max_val);
+    *max_out = max_val;
+    return sum_exp;
+}
+
+static void exp_shift_acc_scalar(float alpha, const float* x, float shift, float* dx, size_t n) {
+    for (size_t i = 0; i < n; i++) dx[i] += alpha * std::exp(x[i] - shift);
+}
+
+static float exp_shift_scalar(const float* x, float shift, float* y, size_t n) {
+    float s = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        y[i] = std::exp(x[i] - shift);
+        s += y[i];
+    }
+    return s;
+}
+
+static void softmax_grad_scalar(const float* y, float dot, float* g, size_t n) {
+    for (size_t i = 0; i < n; i++) g[i] = y[i] * (g[i] - dot);
+}
+
+static float sum_scalar(const float* x, size_t n) {
+    float s = 0.0f;
+    for (size_t i = 0; i < n; i++) s += x[i];
+    return s;
+}
+
+static float max_scalar(const float* x, size_t n) {
+    float m = -INFINITY;
+    for (size_t i = 0; i < n; i++) m = std::max(m, x[i]);
+    return m;
+}
+
+static float dot_scalar(const float* a, const float* b, size_t n) {
+    float s = 0.0f;
+    for (size_t i = 0; i < n; i++) s += a[i] * b[i];
+    return s;
+}
+
+static float sq_dev_sum_scalar(const float* x, float mean, size_t n) {
+    float s = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        float d = x[i] - mean;
+        s += d * d;
+    }
+    return s;
+}
+
+static float sq_diff_sum_scalar(const float* a, const float* b, size_t n) {
+    float s = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        float d = a[i] - b[i];
+        s += d * d;
+    }
+    return s;
+}
+
+static void gemm_micro_scalar(int kc, const float* a, const float* b,
+                              float* c, int ldc, int mr, int nr, float alpha) {
+    float acc[GEMM_MR][GEMM_NR] = {};
+
+    for (int p = 0; p < kc; p++) {
+        for (int i = 0; i < GEMM_MR; i++) {
+            float a_val = a[i];
+            for (int j = 0; j < GEMM_NR; j++) {
+                acc[i][j] += a_val * b[j];
+            }
+        }
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+
+    for (int i = 0; i < mr; i++) {
+        float* c_row = c + (size_t)i * ldc;
+        for (int j = 0; j < nr; j++) {
+            c_row[j] += alpha * acc[i][j];
+        }
+    }
+}
+
+static KernelTable scalar_kernels() {
+    KernelTable t;
+    t.name = "scalar";
+    t.add = add_scalar;
+    t.sub = sub_scalar;
+    t.mul = mul_scalar;
+    t.relu = relu_scalar;
+    t.tanh = tanh_scalar;
+    t.sigmoid = sigmoid_scalar;
+    t.gelu = gelu_scalar;
+    t.exp = exp_scalar;
+    t.axpy = axpy_scalar;
+    t.scale = scale_scalar;
+    t.mul_acc = mul_acc_scalar;
+    t.diff_acc = diff_acc_scalar;
+    t.relu_backward = relu_backward_scalar;
+    t.tanh_backward = tanh_backward_scalar;
+    t.sigmoid_backward = sigmoid_backward_scalar;
+    t.gelu_backward = gelu_backward_scalar;
+    t.relu_grad = relu_grad_scalar;
+    t.tanh_grad = tanh_grad_scalar;
+    t.sigmoid_grad = sigmoid_grad_scalar;
+    t.gelu_grad = gelu_grad_scalar;
+    t.softmax_row = softmax_row_scalar;
+    t.softmax_row_backward = softmax_row_backward_scalar;
+    t.sumexp_row = sumexp_row_scalar;
+    t.exp_shift_acc = exp_shift_acc_scalar;
+    t.exp_shift = exp_shift_scalar;
+    t.softmax_grad = softmax_grad_scalar;
+    t.sum = sum_scalar;
+    t.max = max_scalar;
+    t.dot = dot_scalar;
+    t.sq_dev_sum = sq_dev_sum_scalar;
+    t.sq_diff_sum = sq_diff_sum_scalar;
+    t.gemm_micro = gemm_micro_scalar;
+    return t;
+}
+
+// === DISPATCH ===
+
+static bool cpu_has_avx2() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
+
+static bool cpu_has_avx512() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_cpu_supports("avx512f") && cpu_has_avx2();
+#else
+    return false;
+#endif
+}
+
+static KernelTable select_kernels() {
+    KernelTable t = scalar_kernels();
+
+    // Optional cap from the environment, it can only lower the level
+    const char* env = std::getenv("LLMON_KERNELS");
+    int max_level = 2;
+    if (env && std::strcmp(env, "scalar") == 0) max_level = 0;
+    if (env && std::strcmp(env, "avx2") == 0) max_level = 1;
+
+    if (max_level >= 2 && cpu_has_avx512() && load_avx512_kernels(t)) return t;
+    if (max_level >= 1 && cpu_has_avx2() && load_avx2_kernels(t)) return t;
+    return t;
+}
+
+const KernelTable& kernels() {
+    static const KernelTable table = select_kernels();
+    return table;
+}
+
+// === ACTIVATION DISPATCH ===
+
+void activation_forward(Activation act, const float* x, float* y, size_t n) {
+    const KernelTable& k = kernels();
+    switch (act) {
+        case Activation::None:
+            if (x != y) std::memcpy(y, x, n * sizeof(float));
+            break;
+        case Activation::ReLU: k.relu(x, y, n); break;
+        case Activation::Tanh: k.tanh(x, y, n); break;
+        case Activation::Sigmoid: k.sigmoid(x, y, n); break;
+        case Activation::GELU: k.gelu(x, y, n); break;
+    }
+}
+
+void activation_grad(Activation act, const float* y, const float* x, float* g, size_t n) {
+    const KernelTable& k = kernels();
+    switch (act) {
+        case Activation::None: break;
+        case Activation::ReLU: k.relu_grad(y, g, n); break;
+        case Activation::Tanh: k.tanh_grad(y, g, n); break;
+        case Activation::Sigmoid: k.sigmoid_grad(y, g, n); break;
+        case Activation::GELU: k.gelu_grad(x, g, n); break;
+    }
+}
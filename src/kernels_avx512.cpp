@@ -0,0 +1,91 @@
+/**
+ * AVX-512 kernels, this file is compiled with -mavx512f -mavx2 -mfma
+ * and only ever called after the CPU check in kernels.cpp
+ */
+
+#include "../include/kernels.h"
+
+#if defined(__AVX512F__)
+// GCC 12 avx512fintrin.h self-initializes its "undefined" registers and
+// warns about it at every inlined use (GCC PR 105593)
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+
+namespace {
+
+struct V {
+    typedef __m512 reg;
+    static const int W = 16;
+
+    static reg zero() { return _mm512_setzero_ps(); }
+    static reg set1(float x) { return _mm512_set1_ps(x); }
+    static reg load(const float* p) { return _mm512_loadu_ps(p); }
+    static void store(float* p, reg v) { _mm512_storeu_ps(p, v); }
+
+    static __mmask16 tail_mask(int n) { return (__mmask16)((1u << n) - 1); }
+    static reg load_partial(const float* p, int n, float fill) {
+        return _mm512_mask_loadu_ps(_mm512_set1_ps(fill), tail_mask(n), p);
+    }
+    static void store_partial(float* p, reg v, int n) { _mm512_mask_storeu_ps(p, tail_mask(n), v); }
+
+    static reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+    static reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+    static reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+    static reg div(reg a, reg b) { return _mm512_div_ps(a, b); }
+    static reg max(reg a, reg b) { return _mm512_max_ps(a, b); }
+    static reg min(reg a, reg b) { return _mm512_min_ps(a, b); }
+    static reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_ps(a, b, c); }   // a * b + c
+    static reg fnmadd(reg a, reg b, reg c) { return _mm512_fnmadd_ps(a, b, c); } // c - a * b
+    static reg round(reg x) { return _mm512_roundscale_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+    static reg abs(reg x) { return _mm512_abs_ps(x); }
+    static reg copysign(reg mag, reg sign) {
+        __m512i s = _mm512_set1_epi32((int)0x80000000u);
+        __m512i r = _mm512_or_si512(_mm512_andnot_si512(s, _mm512_castps_si512(mag)),
+                                    _mm512_and_si512(s, _mm512_castps_si512(sign)));
+        return _mm512_castsi512_ps(r);
+    }
+    // a > b ? x : y
+    static reg select_gt(reg a, reg b, reg x, reg y) {
+        return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(a, b, _CMP_GT_OQ), y, x);
+    }
+    // 2^n for integral n in [-126, 127]
+    static reg pow2n(reg n) {
+        __m512i e = _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127));
+        return _mm512_castsi512_ps(_mm512_slli_epi32(e, 23));
+    }
+
+    static __m256 high_half(reg v) {
+        return _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1));
+    }
+    static float hsum(reg v) {
+        __m256 h = _mm256_add_ps(_mm512_castps512_ps256(v), high_half(v));
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(h), _mm256_extractf128_ps(h, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_movehdup_ps(s));
+        return _mm_cvtss_f32(s);
+    }
+    static float hmax(reg v) {
+        __m256 h = _mm256_max_ps(_mm512_castps512_ps256(v), high_half(v));
+        __m128 s = _mm_max_ps(_mm256_castps256_ps128(h), _mm256_extractf128_ps(h, 1));
+        s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_max_ss(s, _mm_movehdup_ps(s));
+        return _mm_cvtss_f32(s);
+    }
+};
+
+#include "kernels_simd.inc"
+
+} // namespace
+
+bool load_avx512_kernels(KernelTable& table) {
+    fill_table(table, "avx512");
+    return true;
+}
+
+#else
+
+bool load_avx512_kernels(KernelTable&) { return false; }
+
+#endif
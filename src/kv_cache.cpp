@@ -0,0 +1,133 @@
+#include "../include/kv_cache.h"
+#include <cassert>
+#include <algorithm>
+
+// === PAGE POOL ===
+
+KVPagePool::KVPagePool(int num_pages, int page_size, int kv_dim)
+    : num_pages_(num_pages), page_size_(page_size), kv_dim_(kv_dim) {
+    assert(num_pages > 0 && page_size > 0 && kv_dim > 0);
+    // Never from a step arena, the pool outlives the steps that fill it
+    keys_.resize((size_t)num_pages * page_stride());
+    values_.resize((size_t)num_pages * page_stride());
+    free_.reserve(num_pages);
+    for (int p = num_pages - 1; p >= 0; p--) free_.push_back(p); // page 0 handed out first
+    refs_.assign(num_pages, 0);
+}
+
+int KVPagePool::allocate() {
+    if (free_.empty()) return -1;
+    int page = free_.back();
+    free_.pop_back();
+    refs_[page] = 1;
+    return page;
+}
+
+void KVPagePool::retain(int page) {
+    assert(page >= 0 && page < num_pages_ && refs_[page] > 0);
+    refs_[page]++;
+}
+
+void KVPagePool::release(int page) {
+    assert(page >= 0 && page < num_pages_ && refs_[page] > 0);
+    if (--refs_[page] == 0) free_.push_back(page);
+}
+
+// === CACHE ===
+
+KVCache::KVCache(int capacity, int kv_dim, int page_size)
+    : KVCache(std::make_shared<KVPagePool>((capacity + page_size - 1) / page_size, page_size, kv_dim),
+              capacity) {}
+
+KVCache::KVCache(std::shared_ptr<KVPagePool> pool, int capacity)
+    : pool_(std::move(pool)), capacity_(capacity), length_(0) {
+    pages_.reserve((capacity + pool_->page_size() - 1) / pool_->page_size());
+}
+
+KVCache::~KVCache() {
+    if (pool_) clear(); // moved-from caches hold nothing
+}
+
+KVCache& KVCache::operator=(KVCache&& other) {
+    if (this != &other) {
+        if (pool_) clear();
+        pool_ = std::move(other.pool_);
+        capacity_ = other.capacity_;
+        length_ = other.length_;
+        pages_ = std::move(other.pages_);
+    }
+    return *this;
+}
+
+bool KVCache::reserve(int n) {
+    assert(n >= 0 && length_ + n <= capacity_ && "KV cache is full");
+    if (n == 0) return true;
+    int ps = pool_->page_size();
+    int needed = (length_ + n + ps - 1) / ps - (int)pages_.size();
+
+    // The next row lands in a partly filled page someone else also reads
+    bool copy_last = length_ % ps != 0 && pool_->ref_count(pages_.back()) > 1;
+    if (std::max(needed, 0) + copy_last > pool_->free_pages()) return false;
+
+    if (copy_last) {
+        int old_page = pages_.back();
+        int page = pool_->allocate();
+        size_t rows = (size_t)(length_ % ps) * pool_->kv_dim();
+        std::copy(pool_->keys(old_page), pool_->keys(old_page) + rows, pool_->keys(page));
+        std::copy(pool_->values(old_page), pool_->values(old_page) + rows, pool_->values(page));
+        pool_->release(old_page);
+        pages_.back() = page;
+    }
+    for (int i = 0; i < needed; i++) pages_.push_back(pool_->allocate());
+    return true;
+}
+
+void KVCache::share(const std::vector<int>& pages, int length) {
+    assert(length_ == 0 && pages_.empty() && length <= capacity_);
+    int ps = pool_->page_size();
+    int count = (length + ps - 1) / ps;
+    assert(count <= (int)pages.size());
+    for (int i = 0; i < count; i++) {
+        pool_->retain(pages[i]);
+        pages_.push_back(pages[i]);
+    }
+    length_ = length;
+}
+
+KVCache KVCache::fork() const {
+    KVCache copy(pool_, capacity_);
+    if (length_ > 0) copy.share(pages_, length_);
+    return copy;
+}
+
+void KVCache::append(const float* k, int ldk, const float* v, int ldv, int n) {
+    bool reserved = reserve(n);
+    assert(reserved && "KV page pool is exhausted");
+    (void)reserved;
+
+    int ps = pool_->page_size();
+    int dim = pool_->kv_dim();
+    for (int i = 0; i < n; i++) {
+        int pos = length_ + i;
+        int page = pages_[pos / ps];
+        size_t row = (size_t)(pos % ps) * dim;
+        std::copy(k + (size_t)i * ldk, k + (size_t)i * ldk + dim, pool_->keys(page) + row);
+        std::copy(v + (size_t)i * ldv, v + (size_t)i * ldv + dim, pool_->values(page) + row);
+    }
+    length_ += n;
+}
+
+void KVCache::truncate(int length) {
+    assert(length >= 0 && length <= length_);
+    int ps = pool_->page_size();
+    int keep = (length + ps - 1) / ps;
+    for (int i = keep; i < (int)pages_.size(); i++) pool_->release(pages_[i]);
+    pages_.resize(keep);
+    length_ = length;
+}
+
+void KVCache::clear() {
+    for (int page : pages_) pool_->release(page);
+    pages_.clear();
+    length_ = 0;
+}
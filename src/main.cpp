@@ -5,6 +5,7 @@
 #include "../include/ops.h"
 #include "../include/optimizer.h"
 #include "../include/nn.h"
+#include "../include/beam_search.h"
 
 int main() {
     std::cout << "=== C++ Micro-GPT: Text Generation ===\n\n";
@@ -13,13 +14,15 @@ int main() {
     int vocab_size = 4;      // 0=pad, 1,2,3=tokens
     int embed_dim = 16;      // Larger for better learning
     int max_seq_len = 4;
-    int head_dim = 16;
+    int num_heads = 4;
+    int head_dim = embed_dim / num_heads;
+    int num_kv_heads = 2;    // Pairs of query heads share K/V (GQA)
 
     std::cout << "Creating GPT model...\n";
     std::cout << "Vocab: " << vocab_size << " | Embed: " << embed_dim << "\n\n";
 
     // Create full GPT model
-    GPT model(vocab_size, embed_dim, max_seq_len, head_dim);
+    GPT model(vocab_size, embed_dim, max_seq_len, head_dim, num_heads, num_kv_heads);
 
     // Use Adam optimizer for better convergence
     Adam optimizer(model.parameters(), 0.01f);
@@ -57,10 +60,15 @@ int main() {
     int epochs = 500;  // Increased epochs
     float final_loss = 0.0f;
 
+    // Graph nodes of each step come from here and are dropped in one go
+    GraphArena arena;
+
     for (int epoch = 0; epoch < epochs; epoch++) {
         float total_loss = 0.0f;
 
         for (size_t idx = 0; idx < train_inputs.size(); idx++) {
+            GraphArena::Scope step(arena);
+
             int seq_len = train_inputs[idx].size();
 
             // Prepare input
@@ -69,24 +77,13 @@ int main() {
                 input->data[i] = train_inputs[idx][i];
             }
 
-            // Prepare target (one-hot encoded)
-            auto target = Tensor::create(seq_len, vocab_size);
-            std::fill(target->data.begin(), target->data.end(), 0.0f);
-            for (int i = 0; i < seq_len; i++) {
-                int target_token = train_targets[idx][i];
-                target->at(i, target_token) = 1.0f;
-            }
-
-            // Forward pass
-            TensorPtr logits = model.forward(input);
-            TensorPtr probs = softmax(logits);
-
-            // Cross-entropy loss
-            TensorPtr loss = cross_entropy_loss(probs, target);
+            // Forward pass and cross-entropy loss, the output head is fused
+            // with the loss so the logits are never stored
+            TensorPtr loss = model.forward_loss(input, train_targets[idx]);
 
             // Backward pass
             optimizer.zero_grad();
-            loss->backward();
+            loss->backward(true); // Same graph shape every step, reuse the order
             optimizer.step();
 
             total_loss += loss->data[0];
@@ -102,8 +99,9 @@ int main() {
     std::cout << "\n=== Training Complete! ===\n";
     std::cout << "Final Loss: " << final_loss << " ✅\n\n";
 
-    // Test the model
+    // Test the model (inference only, no autograd graph)
     std::cout << "=== GENERATION TEST ===\n\n";
+    NoGradGuard no_grad;
 
     // Test with longer context for better results
     std::vector<std::vector<int>> test_cases = {
@@ -184,6 +182,19 @@ int main() {
 
     std::cout << "\n📊 Accuracy: " << correct << "/" << total << " ("
               << (100.0f * correct / total) << "%)\n";
+
+    // Greedy continuation through the KV cache, as far as max_seq_len allows
+    std::cout << "\nGenerate from [1]: [1";
+    model.generate({1}, max_seq_len - 1, SamplingConfig(),
+                   [](int token) { std::cout << ", " << token; });
+    std::cout << "]\n";
+
+    BeamSearchConfig beam;
+    beam.beam_width = 4;
+    BeamHypothesis best = beam_search(model, {1}, max_seq_len - 1, beam)[0];
+    std::cout << "Beam search (width " << beam.beam_width << ") from [1]: [1";
+    for (int token : best.tokens) std::cout << ", " << token;
+    std::cout << "], log p = " << best.log_prob << "\n";
     std::cout << "\n💡 Model successfully learned the cyclic pattern: 1→2→3→1\n";
 
     return 0;
@@ -1,50 +1,28 @@
 #include "../include/nn.h"
+#include "../include/thread_pool.h"
 #include <iostream>
+#include <cassert>
 #include <cmath>
+#include <algorithm>
 
 // === LINEAR IMPLEMENTATION ===
-Linear::Linear(int in_features, int out_features, bool bias_flag) {
+Linear::Linear(int in_features, int out_features, bool bias_flag, Activation act)
+    : activation(act) {
     weight = Tensor::create(in_features, out_features);
     weight->random_init();
+    weight->requires_grad = true; // Parameters always learn, even if built under NoGradGuard
 
     use_bias = bias_flag;
     if (use_bias) {
         bias = Tensor::create(1, out_features);
         std::fill(bias->data.begin(), bias->data.end(), 0.0f);
+        bias->requires_grad = true;
     }
 }
 
 TensorPtr Linear::forward(TensorPtr input) {
-    TensorPtr out = matmul(input, weight);
-
-    if (use_bias) {
-        // Proper bias addition using add() operation with autograd support
-        // Broadcasting: bias (1, out_features) is added to each row of output
-        for (int i = 0; i < out->rows; i++) {
-            for (int j = 0; j < out->cols; j++) {
-                out->at(i, j) += bias->at(0, j);
-            }
-        }
-
-        // Track bias in computation graph for backprop
-        out->prev.push_back(bias);
-
-        // Capture bias as local variable for lambda
-        TensorPtr b = bias;
-        auto old_backward = out->_backward;
-        out->_backward = [out, b, old_backward]() {
-            // First call the matmul backward
-            old_backward();
-
-            // Then accumulate bias gradients (sum over batch dimension)
-            for (int i = 0; i < out->rows; i++) {
-                for (int j = 0; j < out->cols; j++) {
-                    b->grad_at(0, j) += out->grad_at(i, j);
-                }
-            }
-        };
-    }
-    return out;
+    // Matmul, bias and activation in one fused op (ops.h)
+    return linear(input, weight, use_bias ? bias : nullptr, activation);
 }
 
 std::vector<TensorPtr> Linear::parameters() {
@@ -57,17 +35,18 @@ std::vector<TensorPtr> Linear::parameters() {
 Embedding::Embedding(int num_embeddings, int embedding_dim) {
     weight = Tensor::create(num_embeddings, embedding_dim);
     weight->random_init();
+    weight->requires_grad = true;
 }
 
 TensorPtr Embedding::forward(TensorPtr input) {
+    input = contiguous(input);
     int batch_size = input->rows * input->cols; // Total token
     int embed_dim = weight->cols;
 
-    TensorPtr out = Tensor::create(batch_size, embed_dim);
-    out->prev = {weight};
+    TensorPtr out = Tensor::empty(batch_size, embed_dim);
 
     for (int i = 0; i < batch_size; i++) {
-        int token_id = (int)input->data[i];
+        int token_id = (int)input->ptr()[i];
 
         // Safety check
         if (token_id >= weight->rows) token_id = 0;
@@ -77,20 +56,24 @@ TensorPtr Embedding::forward(TensorPtr input) {
         }
     }
 
-    // Capture weight directly instead of 'this' to avoid dangling pointer
-    TensorPtr w = weight;
-    out->_backward = [input, out, w]() {
-        int batch = input->rows * input->cols;
-        int dim = w->cols;
-
-        for (int i = 0; i < batch; i++) {
-            int token_id = (int)input->data[i];
-            if (token_id < 0 || token_id >= w->rows) continue; // Safety check
-            for (int j = 0; j < dim; j++) {
-                w->grad_at(token_id, j) += out->grad_at(i, j);
+    if (out->track({weight})) {
+        // The token ids are read again in backward, prev keeps them alive
+        out->prev.push_back(input);
+
+        // Capture weight directly instead of 'this' to avoid dangling pointer
+        out->_backward = [input = input.get(), out = out.get(), w = weight.get()]() {
+            int batch = input->rows * input->cols;
+            int dim = w->cols;
+
+            for (int i = 0; i < batch; i++) {
+                int token_id = (int)input->ptr()[i];
+                if (token_id < 0 || token_id >= w->rows) continue; // Safety check
+                for (int j = 0; j < dim; j++) {
+                    w->grad_at(token_id, j) += out->grad_at(i, j);
+                }
             }
-        }
-    };
+        };
+    }
 
     return out;
 }
@@ -99,28 +82,22 @@ std::vector<TensorPtr> Embedding::parameters() {
     return {weight};
 }
 
-SelfAttention::SelfAttention(int embed_dim, int head_dim)
+SelfAttention::SelfAttention(int embed_dim, int head_dim, bool causal)
     : Wq(embed_dim, head_dim),
       Wk(embed_dim, head_dim),
-      Wv(embed_dim, head_dim) {}
+      Wv(embed_dim, head_dim),
+      causal(causal) {}
 
 TensorPtr SelfAttention::forward(TensorPtr input) {
     TensorPtr Q = Wq.forward(input); // [Seq, HeadDim]
     TensorPtr K = Wk.forward(input); // [Seq, HeadDim]
     TensorPtr V = Wv.forward(input); // [Seq, HeadDim]
 
-    TensorPtr K_T = transpose(K);    // [HeadDim, Seq]
-    TensorPtr Scores = matmul(Q, K_T); // [Seq, Seq] -> Peta hubungan antar kata!
-
-    // Scaled attention: divide by sqrt(d_k) for stability
+    // Scaled attention: divide by sqrt(d_k) for stability.
+    // softmax(Q @ K^T * scale) @ V in tiles, the [Seq, Seq] scores are never stored
+    // (nor computed above the diagonal when causal)
     float scale = 1.0f / std::sqrt((float)Q->cols);
-    for (size_t i = 0; i < Scores->data.size(); i++) {
-        Scores->data[i] *= scale;
-    }
-
-    TensorPtr AttnWeights = softmax(Scores);
-
-    TensorPtr Output = matmul(AttnWeights, V); // [Seq, HeadDim]
+    TensorPtr Output = attention(Q, K, V, scale, causal); // [Seq, HeadDim]
 
     return Output;
 }
@@ -133,16 +110,99 @@ std::vector<TensorPtr> SelfAttention::parameters() {
     return params;
 }
 
-TransformerBlock::TransformerBlock(int embed_dim, int head_dim)
-    : attn(embed_dim, head_dim), ffn(embed_dim, embed_dim) {} // FFN output size == input size
+// === MULTI-HEAD ATTENTION IMPLEMENTATION ===
+MultiHeadAttention::MultiHeadAttention(int embed_dim, int num_heads, int head_dim, bool causal,
+                                       int num_kv_heads)
+    : num_heads(num_heads),
+      num_kv_heads(num_kv_heads > 0 ? num_kv_heads : num_heads),
+      head_dim(head_dim),
+      Wqkv(embed_dim, (num_heads + 2 * this->num_kv_heads) * head_dim),
+      Wo(num_heads * head_dim, embed_dim),
+      causal(causal) {}
+
+TensorPtr MultiHeadAttention::forward(TensorPtr input) {
+    TensorPtr QKV = Wqkv.forward(input); // [Seq, (Heads + 2 * KVHeads) * HeadDim], one GEMM
+
+    float scale = 1.0f / std::sqrt((float)head_dim);
+    TensorPtr heads = multi_head_attention(QKV, num_heads, num_kv_heads, scale, causal); // [Seq, Heads * HeadDim]
+
+    return Wo.forward(heads); // [Seq, EmbedDim]
+}
+
+TensorPtr MultiHeadAttention::forward(TensorPtr input, const std::vector<int>& offsets) {
+    // Projections are row-wise: one GEMM over every row of the batch
+    TensorPtr QKV = Wqkv.forward(input);
+
+    float scale = 1.0f / std::sqrt((float)head_dim);
+    TensorPtr heads = multi_head_attention(QKV, num_heads, num_kv_heads, scale, causal, offsets);
+
+    return Wo.forward(heads);
+}
+
+TensorPtr MultiHeadAttention::forward_cached(TensorPtr input, KVCache& cache) {
+    return forward_cached(input, {0, input->rows}, {&cache});
+}
+
+TensorPtr MultiHeadAttention::forward_cached(TensorPtr input, const std::vector<int>& offsets,
+                                             const std::vector<KVCache*>& caches) {
+    int batch = (int)caches.size();
+    int q_dim = num_heads * head_dim;
+    int kv_dim = num_kv_heads * head_dim;
+    int group = num_heads / num_kv_heads;
+    assert((int)offsets.size() == batch + 1 && offsets.back() == input->rows);
+
+    // Projections of the new positions only, one GEMM for the whole batch
+    TensorPtr QKV = Wqkv.forward(input);
+    const float* q = QKV->ptr();
+    int ld = QKV->row_stride;
+    for (int b = 0; b < batch; b++) {
+        assert(caches[b]->kv_dim() == kv_dim);
+        size_t row = (size_t)offsets[b] * ld;
+        caches[b]->append(q + row + q_dim, ld, q + row + q_dim + kv_dim, ld, offsets[b + 1] - offsets[b]);
+    }
+
+    // New queries of sequence b are the last ones of its cache, causal lines
+    // them up, keys are read through its page table. One task per
+    // (sequence, query head)
+    float scale = 1.0f / std::sqrt((float)head_dim);
+    TensorPtr heads = Tensor::empty(input->rows, q_dim);
+    float* o = heads->data.data();
+    parallel_for((int64_t)batch * num_heads, 1, [&](int64_t begin, int64_t end) {
+        for (int64_t t = begin; t < end; t++) {
+            int b = (int)(t / num_heads), h = (int)(t % num_heads);
+            int r0 = offsets[b], n = offsets[b + 1] - r0;
+            if (n == 0) continue;
+            const KVCache& cache = *caches[b];
+            const KVPagePool& pool = cache.pool();
+            size_t kv = (size_t)(h / group) * head_dim;
+            paged_attention_forward(n, cache.length(), head_dim, scale, causal,
+                                    q + (size_t)r0 * ld + h * head_dim, ld,
+                                    pool.keys() + kv, pool.values() + kv, kv_dim, pool.page_stride(),
+                                    cache.pages().data(), cache.page_size(),
+                                    o + (size_t)r0 * q_dim + h * head_dim, q_dim, nullptr);
+        }
+    });
+
+    return Wo.forward(heads);
+}
+
+std::vector<TensorPtr> MultiHeadAttention::parameters() {
+    std::vector<TensorPtr> params = Wqkv.parameters();
+    auto p_o = Wo.parameters(); params.insert(params.end(), p_o.begin(), p_o.end());
+    return params;
+}
+
+TransformerBlock::TransformerBlock(int embed_dim, int head_dim, int num_heads, bool causal,
+                                   int num_kv_heads)
+    : attn(embed_dim, num_heads, head_dim, causal, num_kv_heads),
+      ffn(embed_dim, embed_dim, true, Activation::ReLU) {} // FFN output size == input size
 
 TensorPtr TransformerBlock::forward(TensorPtr input) {
     // Self-Attention
     TensorPtr attn_out = attn.forward(input);
 
-    // Feed-forward with ReLU activation
-    TensorPtr ffn_out = ffn.forward(attn_out);
-    TensorPtr x = relu(ffn_out);
+    // Feed-forward, ReLU fused into the Linear
+    TensorPtr x = ffn.forward(attn_out);
 
     // Note: For better results, add Residual Connection and LayerNorm:
     // x = layer_norm(x + input)  // residual
@@ -151,6 +211,21 @@ TensorPtr TransformerBlock::forward(TensorPtr input) {
     return x;
 }
 
+TensorPtr TransformerBlock::forward(TensorPtr input, const std::vector<int>& offsets) {
+    // Only attention mixes rows, it keeps the sequences apart
+    return ffn.forward(attn.forward(input, offsets));
+}
+
+TensorPtr TransformerBlock::forward_cached(TensorPtr input, KVCache& cache) {
+    // Same as forward(), attention goes through the cache
+    return ffn.forward(attn.forward_cached(input, cache));
+}
+
+TensorPtr TransformerBlock::forward_cached(TensorPtr input, const std::vector<int>& offsets,
+                                           const std::vector<KVCache*>& caches) {
+    return ffn.forward(attn.forward_cached(input, offsets, caches));
+}
+
 std::vector<TensorPtr> TransformerBlock::parameters() {
     std::vector<TensorPtr> params = attn.parameters();
     std::vector<TensorPtr> p_ffn = ffn.parameters();
@@ -162,36 +237,60 @@ std::vector<TensorPtr> TransformerBlock::parameters() {
 PositionalEmbedding::PositionalEmbedding(int max_seq_len, int embedding_dim) {
     pos_weight = Tensor::create(max_seq_len, embedding_dim);
     pos_weight->random_init();
+    pos_weight->requires_grad = true;
 }
 
 TensorPtr PositionalEmbedding::forward(TensorPtr input) {
-    // input shape: [seq_len, embed_dim]
+    return forward(input, 0);
+}
+
+TensorPtr PositionalEmbedding::forward(TensorPtr input, int start_pos) {
+    assert(start_pos >= 0 && start_pos + input->rows <= pos_weight->rows);
+    std::vector<int> positions(input->rows);
+    for (int i = 0; i < input->rows; i++) positions[i] = start_pos + i;
+    return add_positions(input, positions);
+}
+
+TensorPtr PositionalEmbedding::forward(TensorPtr input, const std::vector<int>& offsets) {
+    // Every sequence counts its positions from 0
+    assert(offsets.size() >= 2 && offsets.front() == 0 && offsets.back() == input->rows);
+    std::vector<int> positions(input->rows);
+    for (size_t b = 0; b + 1 < offsets.size(); b++) {
+        assert(offsets[b + 1] - offsets[b] <= pos_weight->rows);
+        for (int i = offsets[b]; i < offsets[b + 1]; i++) positions[i] = i - offsets[b];
+    }
+    return add_positions(input, positions);
+}
+
+TensorPtr PositionalEmbedding::add_positions(TensorPtr input, const std::vector<int>& positions) {
+    // input shape: [seq_len, embed_dim], positions: one per row
     int seq_len = input->rows;
     int embed_dim = input->cols;
 
-    TensorPtr output = Tensor::create(seq_len, embed_dim);
-    output->prev = {input, pos_weight};
+    TensorPtr output = Tensor::empty(seq_len, embed_dim);
 
-    // Forward: output = input + pos_weight[0:seq_len]
+    // Forward: output[i] = input[i] + pos_weight[positions[i]]
     for (int i = 0; i < seq_len; i++) {
         for (int j = 0; j < embed_dim; j++) {
-            output->at(i, j) = input->at(i, j) + pos_weight->at(i, j);
+            output->at(i, j) = input->at(i, j) + pos_weight->at(positions[i], j);
         }
     }
 
-    // Backward: gradient flows to both input and pos_weight
-    TensorPtr pw = pos_weight;
-    output->_backward = [input, output, pw]() {
-        int seq_len = output->rows;
-        int embed_dim = output->cols;
-
-        for (int i = 0; i < seq_len; i++) {
-            for (int j = 0; j < embed_dim; j++) {
-                input->grad_at(i, j) += output->grad_at(i, j);
-                pw->grad_at(i, j) += output->grad_at(i, j);
+    if (output->track({input, pos_weight})) {
+        // Backward: gradient flows to both input and pos_weight
+        output->_backward = [input = input.get(), output = output.get(), pw = pos_weight.get(),
+                             positions]() { // copied only when a graph is recorded
+            int seq_len = output->rows;
+            int embed_dim = output->cols;
+
+            for (int i = 0; i < seq_len; i++) {
+                for (int j = 0; j < embed_dim; j++) {
+                    if (input->requires_grad) input->grad_at(i, j) += output->grad_at(i, j);
+                    if (pw->requires_grad) pw->grad_at(positions[i], j) += output->grad_at(i, j);
+                }
             }
-        }
-    };
+        };
+    }
 
     return output;
 }
@@ -201,16 +300,17 @@ std::vector<TensorPtr> PositionalEmbedding::parameters() {
 }
 
 // === GPT IMPLEMENTATION ===
-GPT::GPT(int vocab_size, int embed_dim, int max_seq_len, int head_dim)
+GPT::GPT(int vocab_size, int embed_dim, int max_seq_len, int head_dim, int num_heads,
+         int num_kv_heads)
     : vocab_size(vocab_size),
       embed_dim(embed_dim),
       max_seq_len(max_seq_len),
       token_embed(vocab_size, embed_dim),
       pos_embed(max_seq_len, embed_dim),
-      transformer(embed_dim, head_dim),
+      transformer(embed_dim, head_dim, num_heads, true, num_kv_heads), // Causal: no peeking at later tokens
       output_head(embed_dim, vocab_size, false) {} // No bias for output
 
-TensorPtr GPT::forward(TensorPtr input) {
+TensorPtr GPT::forward_hidden(TensorPtr input) {
     // input: token ids [seq_len, 1] or [batch*seq_len] flattened
     // Step 1: Token Embedding
     TensorPtr tok_emb = token_embed.forward(input);
@@ -219,14 +319,179 @@ TensorPtr GPT::forward(TensorPtr input) {
     TensorPtr x = pos_embed.forward(tok_emb);
 
     // Step 3: Transformer Block
-    x = transformer.forward(x);
+    return transformer.forward(x);
+}
 
+TensorPtr GPT::forward(TensorPtr input) {
     // Step 4: Output projection to vocabulary
-    TensorPtr logits = output_head.forward(x);
+    TensorPtr logits = output_head.forward(forward_hidden(input));
 
     return logits;
 }
 
+TensorPtr GPT::forward_batch(TensorPtr input, const std::vector<int>& lengths) {
+    int batch = input->rows;
+    int seq_len = input->cols;
+    assert((int)lengths.size() == batch);
+
+    // Pack the real tokens row after row, padding never enters the model.
+    // rows[i]: where packed row i goes in the padded output
+    std::vector<int> offsets(batch + 1, 0);
+    for (int b = 0; b < batch; b++) {
+        assert(lengths[b] >= 0 && lengths[b] <= seq_len && lengths[b] <= max_seq_len);
+        offsets[b + 1] = offsets[b] + lengths[b];
+    }
+    int total = offsets[batch];
+    TensorPtr ids = Tensor::empty(total, 1);
+    std::vector<int> rows(total);
+    for (int b = 0; b < batch; b++) {
+        for (int t = 0; t < lengths[b]; t++) {
+            ids->data[offsets[b] + t] = input->at(b, t);
+            rows[offsets[b] + t] = b * seq_len + t;
+        }
+    }
+
+    // Embedding, projections, FFN and the output head each run as one GEMM
+    // over all total rows, attention runs per sequence
+    TensorPtr x = pos_embed.forward(token_embed.forward(ids), offsets);
+    x = transformer.forward(x, offsets);
+    TensorPtr logits = output_head.forward(x);
+
+    return scatter_rows(logits, rows, batch * seq_len);
+}
+
+TensorPtr GPT::forward_loss(TensorPtr input, const std::vector<int>& targets, int vocab_chunk) {
+    TensorPtr x = forward_hidden(input);
+    return linear_cross_entropy(x, output_head.weight, output_head.use_bias ? output_head.bias : nullptr,
+                                targets, vocab_chunk);
+}
+
+KVCache GPT::make_cache() {
+    MultiHeadAttention& attn = transformer.attn;
+    return KVCache(max_seq_len, attn.num_kv_heads * attn.head_dim);
+}
+
+std::shared_ptr<KVPagePool> GPT::make_page_pool(int num_pages, int page_size) {
+    MultiHeadAttention& attn = transformer.attn;
+    return std::make_shared<KVPagePool>(num_pages, page_size, attn.num_kv_heads * attn.head_dim);
+}
+
+KVCache GPT::make_cache(std::shared_ptr<KVPagePool> pool) {
+    MultiHeadAttention& attn = transformer.attn;
+    assert(pool->kv_dim() == attn.num_kv_heads * attn.head_dim);
+    return KVCache(std::move(pool), max_seq_len);
+}
+
+TensorPtr GPT::prefill(const std::vector<int>& tokens, KVCache& cache) {
+    StepBuffers buffers;
+    return forward_cached(tokens.data(), (int)tokens.size(), cache, buffers);
+}
+
+TensorPtr GPT::forward_cached(const int* tokens, int n, KVCache& cache, StepBuffers& buffers) {
+    // assign() keeps the capacity, only a longer step than any before grows them
+    buffers.tokens.assign(tokens, tokens + n);
+    buffers.offsets.assign(2, 0);
+    buffers.offsets[1] = n;
+    buffers.caches.assign(1, &cache);
+    return forward_batch_cached(buffers.tokens, buffers.offsets, buffers.caches, buffers.positions);
+}
+
+TensorPtr GPT::score(const std::vector<int>& tokens, KVCache& cache) {
+    NoGradGuard no_grad;
+    int n = (int)tokens.size();
+    std::vector<int> positions;
+    return output_head.forward(hidden_cached(tokens, {0, n}, {&cache}, positions));
+}
+
+TensorPtr GPT::forward_batch_cached(const std::vector<int>& tokens, const std::vector<int>& offsets,
+                                    const std::vector<KVCache*>& caches) {
+    std::vector<int> positions;
+    return forward_batch_cached(tokens, offsets, caches, positions);
+}
+
+TensorPtr GPT::forward_batch_cached(const std::vector<int>& tokens, const std::vector<int>& offsets,
+                                    const std::vector<KVCache*>& caches, std::vector<int>& positions) {
+    NoGradGuard no_grad;
+    int batch = (int)caches.size();
+    int n = (int)tokens.size();
+    TensorPtr x = hidden_cached(tokens, offsets, caches, positions);
+
+    // Only the last position of each sequence predicts its next token
+    if (batch == 1) return output_head.forward(row(x, n - 1));
+    TensorPtr last = Tensor::empty(batch, embed_dim);
+    for (int b = 0; b < batch; b++) {
+        const float* src = x->ptr() + (size_t)(offsets[b + 1] - 1) * x->row_stride;
+        std::copy(src, src + embed_dim, last->data.data() + (size_t)b * embed_dim);
+    }
+    return output_head.forward(last);
+}
+
+TensorPtr GPT::hidden_cached(const std::vector<int>& tokens, const std::vector<int>& offsets,
+                             const std::vector<KVCache*>& caches, std::vector<int>& positions) {
+    int batch = (int)caches.size();
+    int n = (int)tokens.size();
+    assert(batch > 0 && (int)offsets.size() == batch + 1 && offsets[0] == 0 && offsets[batch] == n);
+
+    // Rows of sequence b continue its cache: positions length(), length() + 1, ..
+    TensorPtr ids = Tensor::empty(n, 1);
+    positions.resize(n);
+    for (int b = 0; b < batch; b++) {
+        int start = caches[b]->length();
+        assert(offsets[b + 1] > offsets[b] && start + offsets[b + 1] - offsets[b] <= max_seq_len);
+        for (int i = offsets[b]; i < offsets[b + 1]; i++) {
+            ids->data[i] = (float)tokens[i];
+            positions[i] = start + i - offsets[b];
+        }
+    }
+
+    TensorPtr x = pos_embed.add_positions(token_embed.forward(ids), positions);
+    return transformer.forward_cached(x, offsets, caches);
+}
+
+TensorPtr GPT::forward_step(int token, int pos, KVCache& cache) {
+    assert(pos == cache.length() && "forward_step must continue the cached sequence");
+    StepBuffers buffers;
+    return forward_cached(&token, 1, cache, buffers);
+}
+
+std::vector<int> GPT::generate(const std::vector<int>& prompt, int max_new_tokens,
+                               const SamplingConfig& config,
+                               const std::function<void(int)>& on_token) {
+    assert(!prompt.empty() && (int)prompt.size() <= max_seq_len);
+    std::vector<int> generated;
+    if (max_new_tokens <= 0) return generated;
+    generated.reserve(max_new_tokens);
+
+    KVCache cache = make_cache();
+    Sampler sampler(config, vocab_size);
+
+    // Every step's tensors come from the same arena and its host-side
+    // inputs from the same buffers, after the first step decoding
+    // allocates nothing
+    GraphArena arena;
+    StepBuffers buffers;
+    int token;
+    {
+        GraphArena::Scope step(arena);
+        token = sampler.sample(forward_cached(prompt.data(), (int)prompt.size(), cache, buffers)->ptr());
+    }
+
+    for (;;) {
+        generated.push_back(token);
+        if (on_token) on_token(token);
+        if ((int)generated.size() == max_new_tokens || token == config.stop_token ||
+            cache.length() == max_seq_len) {
+            break;
+        }
+
+        // Only the new token runs, its logits are the only ones computed
+        GraphArena::Scope step(arena);
+        token = sampler.sample(forward_cached(&token, 1, cache, buffers)->ptr());
+    }
+
+    return generated;
+}
+
 std::vector<TensorPtr> GPT::parameters() {
     std::vector<TensorPtr> params;
 
@@ -1,94 +1,218 @@
 #include "../include/ops.h"
+#include "../include/gemm.h"
+#include "../include/kernels.h"
+#include "../include/thread_pool.h"
 #include <cassert>
 #include <algorithm>
 #include <cmath>
 
-TensorPtr matmul(TensorPtr A, TensorPtr B) {
-    assert(A->cols == B->rows && "Dimensi MatMul Salah!");
+// Element-wise loops are memory bound, only split really large tensors
+static const int64_t ELEMENTWISE_GRAIN = 1 << 15;
 
-    TensorPtr C = Tensor::create(A->rows, B->cols);
-    C->prev = {A, B};
+typedef void (*UnaryKernel)(const float* x, float* y, size_t n);
+typedef void (*BinaryKernel)(const float* a, const float* b, float* y, size_t n);
 
-    for (int i = 0; i < A->rows; i++) {
-        for (int j = 0; j < B->cols; j++) {
-            float sum = 0.0f;
-            for (int k = 0; k < A->cols; k++) {
-                sum += A->at(i, k) * B->at(k, j);
-            }
-            C->at(i, j) = sum;
-        }
+static void run_unary(UnaryKernel f, const float* x, float* y, size_t n) {
+    parallel_for(n, ELEMENTWISE_GRAIN, [&](int64_t begin, int64_t end) {
+        f(x + begin, y + begin, end - begin);
+    });
+}
+
+static void run_binary(BinaryKernel f, const float* a, const float* b, float* y, size_t n) {
+    parallel_for(n, ELEMENTWISE_GRAIN, [&](int64_t begin, int64_t end) {
+        f(a + begin, b + begin, y + begin, end - begin);
+    });
+}
+
+static void run_axpy(float alpha, const float* x, float* y, size_t n) {
+    parallel_for(n, ELEMENTWISE_GRAIN, [&](int64_t begin, int64_t end) {
+        kernels().axpy(alpha, x + begin, y + begin, end - begin);
+    });
+}
+
+// How gemm reads a matrix view in place: X = trans ? S^T : S, with S a
+// row-major buffer of row stride ld. False if neither stride is unit
+static bool gemm_layout(const Tensor* X, bool* trans, int* ld) {
+    if (X->col_stride == 1 || X->cols == 1) {
+        *trans = false;
+        *ld = X->row_stride;
+        return true;
+    }
+    if (X->row_stride == 1 || X->rows == 1) {
+        *trans = true;
+        *ld = X->col_stride;
+        return true;
     }
+    return false;
+}
 
-    C->_backward = [A, B, C]() {
-        // Optimized: dA = dC @ B^T, dB = A^T @ dC
-        for (int i = 0; i < A->rows; i++) {
-            for (int k = 0; k < A->cols; k++) {
-                float grad_a = 0.0f;
-                for (int j = 0; j < B->cols; j++) {
-                    grad_a += C->grad_at(i, j) * B->at(k, j);
-                }
-                A->grad_at(i, k) += grad_a;
-            }
+// Layout of a matmul operand, view or copy, see gemm_layout()
+static TensorPtr gemm_operand(TensorPtr X, bool* trans, int* ld) {
+    if (gemm_layout(X.get(), trans, ld)) return X;
+    X = contiguous(X);
+    gemm_layout(X.get(), trans, ld);
+    return X;
+}
+
+// Gradients of C = alpha * A @ B for a dense dC [M, N], each written in the
+// operand's own layout (dA / dB share A / B's strides, null to skip)
+static void gemm_backward(const float* A, float* dA, bool ta, int lda,
+                          const float* B, float* dB, bool tb, int ldb,
+                          const float* dC, int M, int K, int N, float alpha) {
+    // dA += alpha * dC @ B^T
+    if (dA) {
+        if (!ta) {
+            gemm(false, !tb, M, K, N, alpha, dC, N, B, ldb, 1.0f, dA, lda);
+        } else {
+            gemm(tb, true, K, M, N, alpha, B, ldb, dC, N, 1.0f, dA, lda);
         }
+    }
 
-        for (int k = 0; k < B->rows; k++) {
-            for (int j = 0; j < B->cols; j++) {
-                float grad_b = 0.0f;
-                for (int i = 0; i < A->rows; i++) {
-                    grad_b += A->at(i, k) * C->grad_at(i, j);
-                }
-                B->grad_at(k, j) += grad_b;
-            }
+    // dB += alpha * A^T @ dC
+    if (dB) {
+        if (!tb) {
+            gemm(!ta, false, K, N, M, alpha, A, lda, dC, N, 1.0f, dB, ldb);
+        } else {
+            gemm(true, ta, N, K, M, alpha, dC, N, A, lda, 1.0f, dB, ldb);
         }
-    };
+    }
+}
 
-    return C;
+static void matmul_backward(Tensor* A, bool ta, int lda, Tensor* B, bool tb, int ldb,
+                            const float* dC, int M, int K, int N, float alpha) {
+    gemm_backward(A->ptr(), A->requires_grad ? A->grad_data() : nullptr, ta, lda,
+                  B->ptr(), B->requires_grad ? B->grad_data() : nullptr, tb, ldb,
+                  dC, M, K, N, alpha);
 }
 
-TensorPtr relu(TensorPtr input) {
-    TensorPtr output = Tensor::create(input->rows, input->cols);
-    output->prev = {input};
+TensorPtr matmul(TensorPtr A, TensorPtr B, float alpha) {
+    assert(A->cols == B->rows && "Dimensi MatMul Salah!");
+
+    bool ta = false, tb = false;
+    int lda = 0, ldb = 0;
+    A = gemm_operand(A, &ta, &lda);
+    B = gemm_operand(B, &tb, &ldb);
 
-    for (size_t i = 0; i < input->data.size(); i++) {
-        output->data[i] = std::max(0.0f, input->data[i]);
+    int M = A->rows, K = A->cols, N = B->cols;
+    TensorPtr C = Tensor::empty(M, N);
+
+    // Forward: C = alpha * A @ B, views (e.g. a transpose) are read in place
+    gemm(ta, tb, M, N, K,
+         alpha, A->ptr(), lda, B->ptr(), ldb,
+         0.0f, C->data.data(), N);
+
+    if (C->track({A, B})) {
+        C->_backward = [A = A.get(), B = B.get(), C = C.get(), M, K, N, ta, tb, lda, ldb, alpha]() {
+            matmul_backward(A, ta, lda, B, tb, ldb, C->grad.data(), M, K, N, alpha);
+        };
     }
 
-    output->_backward = [input, output]() {
-        for (size_t i = 0; i < input->data.size(); i++) {
-            if (input->data[i] > 0) {
-                input->grad[i] += output->grad[i];
-            } else {
-                // Gradien 0, do nothing
+    return C;
+}
+
+TensorPtr linear(TensorPtr input, TensorPtr weight, TensorPtr bias, Activation act) {
+    assert(input->cols == weight->rows && "Dimensi Linear Salah!");
+    assert(!bias || (bias->rows == 1 && bias->cols == weight->cols));
+
+    bool tx = false, tw = false;
+    int ldx = 0, ldw = 0;
+    input = gemm_operand(input, &tx, &ldx);
+    weight = gemm_operand(weight, &tw, &ldw);
+    if (bias) bias = contiguous(bias);
+
+    int M = input->rows, K = input->cols, N = weight->cols;
+    TensorPtr out = Tensor::empty(M, N);
+    bool tracked = bias ? out->track({input, weight, bias}) : out->track({input, weight});
+
+    // GELU's derivative needs its input, the others are computed from the output
+    FloatBuffer pre(TensorAllocator<float>(GraphArena::current()));
+    if (tracked && act == Activation::GELU) pre.resize((size_t)M * N);
+
+    // Forward: out = act(input @ weight + bias), bias and act in the GEMM epilogue
+    GemmEpilogue epilogue = {bias ? bias->ptr() : nullptr, act, pre.empty() ? nullptr : pre.data(), N};
+    gemm(tx, tw, M, N, K,
+         1.0f, input->ptr(), ldx, weight->ptr(), ldw,
+         0.0f, out->data.data(), N, &epilogue);
+
+    if (tracked) {
+        Tensor* b = bias ? bias.get() : nullptr;
+        out->_backward = [x = input.get(), w = weight.get(), b, out = out.get(),
+                          M, K, N, tx, tw, ldx, ldw, act, pre = std::move(pre)]() {
+            // dZ = dY * act'(Z) overwrites dY (dead after this step), unless
+            // the caller asked to keep it
+            float* dz = out->grad.data();
+            FloatBuffer kept(TensorAllocator<float>(GraphArena::current()));
+            if (out->retain_grad) {
+                kept.assign(out->grad.begin(), out->grad.end());
+                dz = kept.data();
             }
-        }
-    };
+
+            // One sweep: activation mask / derivative and the bias gradient.
+            // Split over columns so each chunk owns its slice of db
+            float* db = b && b->requires_grad ? b->grad_data() : nullptr;
+            if (act != Activation::None || db) {
+                const float* y = out->data.data();
+                const float* z = pre.empty() ? nullptr : pre.data();
+                int64_t col_grain = std::max<int64_t>(GEMM_NR, ELEMENTWISE_GRAIN / std::max(M, 1));
+                parallel_for(N, col_grain, [&](int64_t j0, int64_t j1) {
+                    const KernelTable& k = kernels();
+                    size_t n = j1 - j0;
+                    for (int i = 0; i < M; i++) {
+                        size_t at = (size_t)i * N + j0;
+                        activation_grad(act, y + at, z ? z + at : nullptr, dz + at, n);
+                        if (db) k.axpy(1.0f, dz + at, db + j0, n);
+                    }
+                });
+            }
+
+            matmul_backward(x, tx, ldx, w, tw, ldw, dz, M, K, N, 1.0f);
+        };
+    }
+
+    return out;
+}
+
+TensorPtr relu(TensorPtr input) {
+    input = contiguous(input);
+    TensorPtr output = Tensor::empty(input->rows, input->cols);
+
+    run_unary(kernels().relu, input->ptr(), output->data.data(), input->size());
+
+    if (output->track({input})) {
+        output->_backward = [input = input.get(), output = output.get()]() {
+            // Gradient flows only where input > 0
+            run_binary(kernels().relu_backward, input->ptr(), output->grad.data(),
+                       input->grad_data(), input->size());
+        };
+    }
 
     return output;
 }
 
 TensorPtr sub(TensorPtr A, TensorPtr B) {
     assert(A->rows == B->rows && A->cols == B->cols);
-    TensorPtr C = Tensor::create(A->rows, A->cols);
-    C->prev = {A, B};
+    A = contiguous(A);
+    B = contiguous(B);
+    TensorPtr C = Tensor::empty(A->rows, A->cols);
 
     // Forward: C = A - B
-    for (size_t i = 0; i < A->data.size(); i++) {
-        C->data[i] = A->data[i] - B->data[i];
+    run_binary(kernels().sub, A->ptr(), B->ptr(), C->data.data(), A->size());
+
+    if (C->track({A, B})) {
+        // Backward
+        C->_backward = [A = A.get(), B = B.get(), C = C.get()]() {
+            if (A->requires_grad) run_axpy(1.0f, C->grad.data(), A->grad_data(), A->size());
+            if (B->requires_grad) run_axpy(-1.0f, C->grad.data(), B->grad_data(), B->size());
+        };
     }
 
-    // Backward
-    C->_backward = [A, B, C]() {
-        for (size_t i = 0; i < A->data.size(); i ++) {
-            A->grad[i] += C->grad[i];
-            B->grad[i] -= C->grad[i];
-        }
-    };
-
     return C;
 }
 
 TensorPtr mse_loss(TensorPtr pred, TensorPtr target) {
     assert(pred->rows == target->rows && pred->cols == target->cols);
+    pred = contiguous(pred);
+    target = contiguous(target);
 
     /**
      * Output loss is usually scalar 1x1, but we keep the size the same
@@ -96,86 +220,131 @@ TensorPtr mse_loss(TensorPtr pred, TensorPtr target) {
      * Actually, MSE averages the error. Here we'll use Sum Squared Error
      * first for simplicity.
      */
-    TensorPtr loss = Tensor::create(1, 1);
-    loss->prev = {pred, target};
+    TensorPtr loss = Tensor::empty(1, 1);
 
     // forward: sum((pred-target)^2)
-    float sum_sq_error = 0.0f;
-    for (size_t i = 0; i < pred->data.size(); i++) {
-        float diff = pred->data[i] - target->data[i];
-        sum_sq_error += diff * diff;
+    float sum_sq_error = kernels().sq_diff_sum(pred->ptr(), target->ptr(), pred->size());
+    loss->data[0] = sum_sq_error / pred->size();
+
+    if (loss->track({pred, target})) {
+        // Backward: d_pred = 2 * (pred - target) / n * grad_loss
+        loss->_backward = [pred = pred.get(), target = target.get(), loss = loss.get()]() {
+            float n = (float)pred->size();
+            if (!pred->requires_grad) return;
+            kernels().diff_acc(2.0f / n * loss->grad[0], pred->ptr(), target->ptr(),
+                               pred->grad_data(), pred->size());
+        };
     }
-    loss->data[0] = sum_sq_error / pred->data.size();
-
-    loss->_backward = [pred, target, loss]() {
-        float n = (float)pred->data.size();
-        for (size_t i = 0; i < pred->data.size(); i++) {
-            float diff = pred->data[i] - target->data[i];
-            float grad = (2.0f * diff / n) * loss->grad[0];
-            pred->grad[i] += grad;
-        }
-    };
 
     return loss;
 }
 
+// === VIEWS ===
+// O(1): no data is copied, gradients go straight into the source's buffer
+
 TensorPtr transpose(TensorPtr A) {
-    TensorPtr C = Tensor::create(A->cols, A->rows);
-    C->prev = {A};
+    // Swap the strides, C[j, i] is A[i, j]
+    return Tensor::view(A, A->cols, A->rows, A->offset, A->col_stride, A->row_stride);
+}
 
-    // Forward: C[j, i] = A[i, j]
+TensorPtr narrow(TensorPtr A, int dim, int start, int length) {
+    assert((dim == 0 || dim == 1) && start >= 0 && length >= 0);
+    if (dim == 0) {
+        assert(start + length <= A->rows);
+        return Tensor::view(A, length, A->cols, A->offset + (size_t)start * A->row_stride,
+                            A->row_stride, A->col_stride);
+    }
+    assert(start + length <= A->cols);
+    return Tensor::view(A, A->rows, length, A->offset + (size_t)start * A->col_stride,
+                        A->row_stride, A->col_stride);
+}
+
+TensorPtr row(TensorPtr A, int i) {
+    return narrow(A, 0, i, 1);
+}
+
+TensorPtr contiguous(TensorPtr A) {
+    if (A->is_contiguous()) return A;
+
+    TensorPtr C = Tensor::empty(A->rows, A->cols);
     for (int i = 0; i < A->rows; i++) {
         for (int j = 0; j < A->cols; j++) {
-            C->at(j, i) = A->at(i, j);
+            C->at(i, j) = A->at(i, j);
         }
     }
 
-    // Backward: Grad A[i, j] += Grad C[j, i]
-    C->_backward = [A, C]() {
-        for (int i = 0; i < A->rows; i++) {
-            for (int j = 0; j < A->cols; j++) {
-                A->grad_at(i, j) += C->grad_at(j, i);
+    if (C->track({A})) {
+        // Backward: scatter back through A's strides
+        C->_backward = [A = A.get(), C = C.get()]() {
+            float* dA = A->grad_data();
+            const float* dC = C->grad.data();
+            for (int i = 0; i < A->rows; i++) {
+                for (int j = 0; j < A->cols; j++) {
+                    dA[(size_t)i * A->row_stride + (size_t)j * A->col_stride] += dC[(size_t)i * A->cols + j];
+                }
             }
-        }
-    };
+        };
+    }
     return C;
 }
 
-TensorPtr softmax(TensorPtr input) {
-    TensorPtr output = Tensor::create(input->rows, input->cols);
-    output->prev = {input};
-
-    // Forward (Row-wise Softmax)
-    for (int i = 0; i < input->rows; i++) {
-        float max_val = -1e9;
-        for (int j = 0; j < input->cols; j++) max_val = std::max(max_val, input->at(i, j));
-
-        float sum_exp = 0.0f;
-        for (int j = 0; j < input->cols; j++) {
-            float val = std::exp(input->at(i, j) - max_val);
-            output->at(i, j) = val;
-            sum_exp += val;
-        }
-
-        for (int j = 0; j < input->cols; j++) {
-            output->at(i, j) /= sum_exp;
-        }
+TensorPtr scatter_rows(TensorPtr A, const std::vector<int>& index, int rows) {
+    assert((int)index.size() == A->rows);
+    TensorPtr out = Tensor::create(rows, A->cols);
+    int cols = A->cols;
+    for (int i = 0; i < A->rows; i++) {
+        assert(index[i] >= 0 && index[i] < rows);
+        float* dst = out->data.data() + (size_t)index[i] * cols;
+        for (int j = 0; j < cols; j++) dst[j] = A->at(i, j);
     }
 
-    output->_backward = [input, output]() {
-        for (int i = 0; i < input->rows; i++) {
-            float dot = 0.0f;
-            for (int k = 0; k < input->cols; k++) {
-                dot += output->at(i, k) * output->grad_at(i, k);
+    if (out->track({A})) {
+        // Backward: gather the same rows back
+        out->_backward = [A = A.get(), out = out.get(), index]() {
+            float* dA = A->grad_data();
+            int cols = A->cols;
+            for (int i = 0; i < A->rows; i++) {
+                const float* src = out->grad.data() + (size_t)index[i] * cols;
+                for (int j = 0; j < cols; j++)
+                    dA[(size_t)i * A->row_stride + (size_t)j * A->col_stride] += src[j];
             }
+        };
+    }
+    return out;
+}
 
-            for (int j = 0; j < input->cols; j++) {
-                float s = output->at(i, j);
-                float g = output->grad_at(i, j);
-                input->grad_at(i, j) += s * (g - dot);
-            }
+// === ACTIVATIONS AND REDUCTIONS ===
+
+TensorPtr softmax(TensorPtr input) {
+    // Rows are processed one at a time, so only the columns must be dense
+    if (input->col_stride != 1 && input->cols > 1) input = contiguous(input);
+    TensorPtr output = Tensor::empty(input->rows, input->cols);
+
+    // Forward (Row-wise Softmax), rows are independent -> split over row blocks
+    int cols = input->cols;
+    int64_t row_grain = std::max<int64_t>(1, ELEMENTWISE_GRAIN / std::max(cols, 1));
+    parallel_for(input->rows, row_grain, [&](int64_t begin, int64_t end) {
+        const KernelTable& k = kernels();
+        for (int64_t i = begin; i < end; i++) {
+            k.softmax_row(&input->at(i, 0), &output->at(i, 0), cols);
         }
-    };
+    });
+
+    if (output->track({input})) {
+        // Backward: dx = s * (g - dot(s, g)) per row
+        output->_backward = [input = input.get(), output = output.get(), row_grain]() {
+            int cols = input->cols;
+            size_t dx_stride = input->row_stride;
+            float* dx = input->grad_data();
+            parallel_for(input->rows, row_grain, [&](int64_t begin, int64_t end) {
+                const KernelTable& k = kernels();
+                for (int64_t i = begin; i < end; i++) {
+                    k.softmax_row_backward(&output->at(i, 0), &output->grad[i * cols],
+                                           dx + i * dx_stride, cols);
+                }
+            });
+        };
+    }
     return output;
 }
 
@@ -183,110 +352,296 @@ TensorPtr softmax(TensorPtr input) {
 
 TensorPtr add(TensorPtr A, TensorPtr B) {
     assert(A->rows == B->rows && A->cols == B->cols);
-    TensorPtr C = Tensor::create(A->rows, A->cols);
-    C->prev = {A, B};
+    A = contiguous(A);
+    B = contiguous(B);
+    TensorPtr C = Tensor::empty(A->rows, A->cols);
 
     // Forward: C = A + B
-    for (size_t i = 0; i < A->data.size(); i++) {
-        C->data[i] = A->data[i] + B->data[i];
+    run_binary(kernels().add, A->ptr(), B->ptr(), C->data.data(), A->size());
+
+    if (C->track({A, B})) {
+        // Backward: dA = dC, dB = dC
+        C->_backward = [A = A.get(), B = B.get(), C = C.get()]() {
+            if (A->requires_grad) run_axpy(1.0f, C->grad.data(), A->grad_data(), A->size());
+            if (B->requires_grad) run_axpy(1.0f, C->grad.data(), B->grad_data(), B->size());
+        };
     }
 
-    // Backward: dA = dC, dB = dC
-    C->_backward = [A, B, C]() {
-        for (size_t i = 0; i < A->data.size(); i++) {
-            A->grad[i] += C->grad[i];
-            B->grad[i] += C->grad[i];
-        }
-    };
-
     return C;
 }
 
 TensorPtr multiply(TensorPtr A, TensorPtr B) {
     assert(A->rows == B->rows && A->cols == B->cols);
-    TensorPtr C = Tensor::create(A->rows, A->cols);
-    C->prev = {A, B};
+    A = contiguous(A);
+    B = contiguous(B);
+    TensorPtr C = Tensor::empty(A->rows, A->cols);
 
     // Forward: C = A * B (element-wise)
-    for (size_t i = 0; i < A->data.size(); i++) {
-        C->data[i] = A->data[i] * B->data[i];
-    }
+    run_binary(kernels().mul, A->ptr(), B->ptr(), C->data.data(), A->size());
 
-    // Backward: dA = dC * B, dB = dC * A
-    C->_backward = [A, B, C]() {
-        for (size_t i = 0; i < A->data.size(); i++) {
-            A->grad[i] += C->grad[i] * B->data[i];
-            B->grad[i] += C->grad[i] * A->data[i];
-        }
-    };
+    if (C->track({A, B})) {
+        // Backward: dA = dC * B, dB = dC * A
+        C->_backward = [A = A.get(), B = B.get(), C = C.get()]() {
+            if (A->requires_grad) {
+                run_binary(kernels().mul_acc, C->grad.data(), B->ptr(), A->grad_data(), A->size());
+            }
+            if (B->requires_grad) {
+                run_binary(kernels().mul_acc, C->grad.data(), A->ptr(), B->grad_data(), B->size());
+            }
+        };
+    }
 
     return C;
 }
 
 TensorPtr tanh_activation(TensorPtr input) {
-    TensorPtr output = Tensor::create(input->rows, input->cols);
-    output->prev = {input};
+    input = contiguous(input);
+    TensorPtr output = Tensor::empty(input->rows, input->cols);
 
     // Forward: tanh(x)
-    for (size_t i = 0; i < input->data.size(); i++) {
-        output->data[i] = std::tanh(input->data[i]);
+    run_unary(kernels().tanh, input->ptr(), output->data.data(), input->size());
+
+    if (output->track({input})) {
+        // Backward: d_tanh = (1 - tanh^2) * grad_out
+        output->_backward = [input = input.get(), output = output.get()]() {
+            run_binary(kernels().tanh_backward, output->data.data(), output->grad.data(),
+                       input->grad_data(), input->size());
+        };
     }
 
-    // Backward: d_tanh = (1 - tanh^2) * grad_out
-    output->_backward = [input, output]() {
-        for (size_t i = 0; i < input->data.size(); i++) {
-            float tanh_val = output->data[i];
-            input->grad[i] += (1.0f - tanh_val * tanh_val) * output->grad[i];
-        }
-    };
-
     return output;
 }
 
 TensorPtr sigmoid(TensorPtr input) {
-    TensorPtr output = Tensor::create(input->rows, input->cols);
-    output->prev = {input};
+    input = contiguous(input);
+    TensorPtr output = Tensor::empty(input->rows, input->cols);
 
     // Forward: sigmoid(x) = 1 / (1 + exp(-x))
-    for (size_t i = 0; i < input->data.size(); i++) {
-        output->data[i] = 1.0f / (1.0f + std::exp(-input->data[i]));
+    run_unary(kernels().sigmoid, input->ptr(), output->data.data(), input->size());
+
+    if (output->track({input})) {
+        // Backward: d_sigmoid = sigmoid * (1 - sigmoid) * grad_out
+        output->_backward = [input = input.get(), output = output.get()]() {
+            run_binary(kernels().sigmoid_backward, output->data.data(), output->grad.data(),
+                       input->grad_data(), input->size());
+        };
     }
 
-    // Backward: d_sigmoid = sigmoid * (1 - sigmoid) * grad_out
-    output->_backward = [input, output]() {
-        for (size_t i = 0; i < input->data.size(); i++) {
-            float sig_val = output->data[i];
-            input->grad[i] += sig_val * (1.0f - sig_val) * output->grad[i];
-        }
-    };
+    return output;
+}
+
+TensorPtr gelu(TensorPtr input) {
+    input = contiguous(input);
+    TensorPtr output = Tensor::empty(input->rows, input->cols);
+
+    // Forward: 0.5 * x * (1 + tanh(sqrt(2 / pi) * (x + 0.044715 * x^3)))
+    run_unary(kernels().gelu, input->ptr(), output->data.data(), input->size());
+
+    if (output->track({input})) {
+        output->_backward = [input = input.get(), output = output.get()]() {
+            run_binary(kernels().gelu_backward, input->ptr(), output->grad.data(),
+                       input->grad_data(), input->size());
+        };
+    }
 
     return output;
 }
 
 TensorPtr cross_entropy_loss(TensorPtr pred, TensorPtr target) {
     assert(pred->rows == target->rows && pred->cols == target->cols);
+    pred = contiguous(pred);
+    target = contiguous(target);
 
-    TensorPtr loss = Tensor::create(1, 1);
-    loss->prev = {pred, target};
+    TensorPtr loss = Tensor::empty(1, 1);
 
     // Forward: -sum(target * log(pred + eps)) / batch_size
     float total_loss = 0.0f;
     const float eps = 1e-7f; // For numerical stability
 
-    for (size_t i = 0; i < pred->data.size(); i++) {
-        total_loss -= target->data[i] * std::log(pred->data[i] + eps);
+    const float* p = pred->ptr();
+    const float* t = target->ptr();
+    for (size_t i = 0; i < pred->size(); i++) {
+        total_loss -= t[i] * std::log(p[i] + eps);
     }
     loss->data[0] = total_loss / pred->rows;
 
-    // Backward: -target / (pred + eps) * grad_loss / batch_size
-    loss->_backward = [pred, target, loss]() {
-        const float eps = 1e-7f;
-        float n = (float)pred->rows;
+    if (loss->track({pred, target})) {
+        // Backward: -target / (pred + eps) * grad_loss / batch_size
+        loss->_backward = [pred = pred.get(), target = target.get(), loss = loss.get()]() {
+            if (!pred->requires_grad) return;
+            const float eps = 1e-7f;
+            float n = (float)pred->rows;
+            float* dpred = pred->grad_data();
+            const float* p = pred->ptr();
+            const float* t = target->ptr();
+
+            for (size_t i = 0; i < pred->size(); i++) {
+                dpred[i] += (-t[i] / (p[i] + eps)) * loss->grad[0] / n;
+            }
+        };
+    }
+
+    return loss;
+}
 
-        for (size_t i = 0; i < pred->data.size(); i++) {
-            pred->grad[i] += (-target->data[i] / (pred->data[i] + eps)) * loss->grad[0] / n;
+TensorPtr cross_entropy_with_logits(TensorPtr logits, const std::vector<int>& targets) {
+    assert((int)targets.size() == logits->rows);
+    if (logits->col_stride != 1 && logits->cols > 1) logits = contiguous(logits);
+    int rows = logits->rows;
+    int cols = logits->cols;
+
+    // Only the log-sum-exp of each row is kept, never the probabilities
+    FloatBuffer lse(TensorAllocator<float>(GraphArena::current()));
+    lse.resize(rows);
+    int64_t row_grain = std::max<int64_t>(1, ELEMENTWISE_GRAIN / std::max(cols, 1));
+    parallel_for(rows, row_grain, [&](int64_t begin, int64_t end) {
+        const KernelTable& k = kernels();
+        for (int64_t i = begin; i < end; i++) {
+            float max_val;
+            float sum = k.sumexp_row(&logits->at(i, 0), cols, &max_val);
+            lse[i] = max_val + std::log(sum);
         }
-    };
+    });
+
+    // Forward: mean(lse - x[target]) = -mean(log(softmax(x))[target])
+    TensorPtr loss = Tensor::empty(1, 1);
+    float total_loss = 0.0f;
+    for (int i = 0; i < rows; i++) {
+        assert(targets[i] >= 0 && targets[i] < cols);
+        total_loss += lse[i] - logits->at(i, targets[i]);
+    }
+    loss->data[0] = total_loss / rows;
+
+    if (loss->track({logits})) {
+        std::vector<int, TensorAllocator<int>> ids(targets.begin(), targets.end(),
+                                                   TensorAllocator<int>(GraphArena::current()));
+        // Backward: dx = (softmax(x) - onehot(target)) * grad_loss / batch_size
+        loss->_backward = [logits = logits.get(), loss = loss.get(), row_grain,
+                           lse = std::move(lse), ids = std::move(ids)]() {
+            int cols = logits->cols;
+            size_t dx_stride = logits->row_stride;
+            float scale = loss->grad[0] / logits->rows;
+            float* dx = logits->grad_data();
+            parallel_for(logits->rows, row_grain, [&](int64_t begin, int64_t end) {
+                const KernelTable& k = kernels();
+                for (int64_t i = begin; i < end; i++) {
+                    float* dx_row = dx + i * dx_stride;
+                    k.exp_shift_acc(scale, &logits->at(i, 0), lse[i], dx_row, cols);
+                    dx_row[ids[i]] -= scale;
+                }
+            });
+        };
+    }
 
     return loss;
-}
\ No newline at end of file
+}
+
+// log(exp(a) + exp(b)), a may be -inf
+static float log_add_exp(float a, float b) {
+    float hi = std::max(a, b), lo = std::min(a, b);
+    return hi + std::log1p(std::exp(lo - hi));
+}
+
+TensorPtr linear_cross_entropy(TensorPtr input, TensorPtr weight, TensorPtr bias,
+                               const std::vector<int>& targets, int chunk) {
+    assert(input->cols == weight->rows && "Dimensi Linear Salah!");
+    assert(!bias || (bias->rows == 1 && bias->cols == weight->cols));
+    assert((int)targets.size() == input->rows && chunk > 0);
+
+    bool tx = false, tw = false;
+    int ldx = 0, ldw = 0;
+    input = gemm_operand(input, &tx, &ldx);
+    weight = gemm_operand(weight, &tw, &ldw);
+    if (bias) bias = contiguous(bias);
+
+    int M = input->rows, K = input->cols, V = weight->cols;
+    chunk = std::min(chunk, V);
+    int64_t row_grain = std::max<int64_t>(1, ELEMENTWISE_GRAIN / chunk);
+
+    // Logits of one vocabulary chunk at a time, [M, chunk]. The running
+    // log-sum-exp of every row is merged chunk by chunk
+    FloatBuffer z(TensorAllocator<float>(GraphArena::current()));
+    z.resize((size_t)M * chunk);
+    FloatBuffer lse(TensorAllocator<float>(GraphArena::current()));
+    lse.assign(M, -INFINITY);
+    std::vector<float> target_logit(M);
+
+    for (int j0 = 0; j0 < V; j0 += chunk) {
+        int n = std::min(chunk, V - j0);
+        GemmEpilogue epilogue = {bias ? bias->ptr() + j0 : nullptr, Activation::None, nullptr, 0};
+        gemm(tx, tw, M, n, K,
+             1.0f, input->ptr(), ldx, weight->ptr() + (tw ? (size_t)j0 * ldw : j0), ldw,
+             0.0f, z.data(), n, &epilogue);
+
+        parallel_for(M, row_grain, [&](int64_t begin, int64_t end) {
+            const KernelTable& k = kernels();
+            for (int64_t i = begin; i < end; i++) {
+                const float* zi = z.data() + i * n;
+                float max_val;
+                float sum = k.sumexp_row(zi, n, &max_val);
+                lse[i] = log_add_exp(lse[i], max_val + std::log(sum));
+                int t = targets[i] - j0;
+                if (t >= 0 && t < n) target_logit[i] = zi[t];
+            }
+        });
+    }
+
+    // Forward: mean(lse - logit[target]), same loss as cross_entropy_with_logits
+    TensorPtr loss = Tensor::empty(1, 1);
+    float total_loss = 0.0f;
+    for (int i = 0; i < M; i++) {
+        assert(targets[i] >= 0 && targets[i] < V);
+        total_loss += lse[i] - target_logit[i];
+    }
+    loss->data[0] = total_loss / M;
+
+    bool tracked = bias ? loss->track({input, weight, bias}) : loss->track({input, weight});
+    if (tracked) {
+        std::vector<int, TensorAllocator<int>> ids(targets.begin(), targets.end(),
+                                                   TensorAllocator<int>(GraphArena::current()));
+        // Backward: logits are recomputed per chunk, dZ = (softmax - onehot) * scale
+        // feeds dX, dW[:, chunk] and db[chunk] before the next chunk
+        loss->_backward = [x = input.get(), w = weight.get(), b = bias ? bias.get() : nullptr,
+                           loss = loss.get(), M, K, V, tx, tw, ldx, ldw, chunk, row_grain,
+                           lse = std::move(lse), ids = std::move(ids)]() {
+            float scale = loss->grad[0] / M;
+            float* dx = x->requires_grad ? x->grad_data() : nullptr;
+            float* dw = w->requires_grad ? w->grad_data() : nullptr;
+            float* db = b && b->requires_grad ? b->grad_data() : nullptr;
+
+            FloatBuffer z(TensorAllocator<float>(GraphArena::current()));
+            FloatBuffer dz(TensorAllocator<float>(GraphArena::current()));
+            z.resize((size_t)M * chunk);
+            dz.resize((size_t)M * chunk);
+
+            for (int j0 = 0; j0 < V; j0 += chunk) {
+                int n = std::min(chunk, V - j0);
+                size_t w_off = tw ? (size_t)j0 * ldw : j0;
+                GemmEpilogue epilogue = {b ? b->ptr() + j0 : nullptr, Activation::None, nullptr, 0};
+                gemm(tx, tw, M, n, K,
+                     1.0f, x->ptr(), ldx, w->ptr() + w_off, ldw,
+                     0.0f, z.data(), n, &epilogue);
+
+                parallel_for(M, row_grain, [&](int64_t begin, int64_t end) {
+                    const KernelTable& k = kernels();
+                    for (int64_t i = begin; i < end; i++) {
+                        float* dzi = dz.data() + i * n;
+                        std::fill(dzi, dzi + n, 0.0f);
+                        k.exp_shift_acc(scale, z.data() + i * n, lse[i], dzi, n);
+                        int t = ids[i] - j0;
+                        if (t >= 0 && t < n) dzi[t] -= scale;
+                    }
+                });
+
+                if (db) {
+                    for (int i = 0; i < M; i++) kernels().axpy(1.0f, dz.data() + (size_t)i * n, db + j0, n);
+                }
+                gemm_backward(x->ptr(), dx, tx, ldx,
+                              w->ptr() + w_off, dw ? dw + w_off : nullptr, tw, ldw,
+                              dz.data(), M, K, n, 1.0f);
+            }
+        };
+    }
+
+    return loss;
+}
@@ -0,0 +1,151 @@
+#include "../include/prefix_cache.h"
+#include <cassert>
+#include <algorithm>
+
+// FNV-1a over the token ids of one block
+static uint64_t hash_block(const int* tokens, int n) {
+    uint64_t h = 1469598103934665603ULL;
+    for (int i = 0; i < n; i++) {
+        uint32_t t = (uint32_t)tokens[i];
+        for (int b = 0; b < 4; b++) {
+            h ^= (t >> (8 * b)) & 0xff;
+            h *= 1099511628211ULL;
+        }
+    }
+    return h;
+}
+
+PrefixCache::PrefixCache(std::shared_ptr<KVPagePool> pool, int max_pages)
+    : pool_(std::move(pool)), max_pages_(max_pages) {
+    assert(max_pages >= 0);
+}
+
+PrefixCache::~PrefixCache() {
+    release_subtree(&root_);
+}
+
+PrefixCache::Node* PrefixCache::child(Node* node, const int* block) {
+    int ps = pool_->page_size();
+    auto it = node->children.find(hash_block(block, ps));
+    if (it == node->children.end()) return nullptr;
+    Node* c = it->second.get();
+    return std::equal(block, block + ps, c->tokens.begin()) ? c : nullptr;
+}
+
+int PrefixCache::match(const std::vector<int>& tokens, KVCache& cache) {
+    assert(cache.length() == 0 && &cache.pool() == pool_.get());
+    lookups_++;
+    clock_++;
+    int ps = pool_->page_size();
+    int max_blocks = ((int)tokens.size() - 1) / ps; // the last token is always computed
+
+    std::vector<int> pages;
+    Node* node = &root_;
+    for (int b = 0; b < max_blocks; b++) {
+        Node* c = child(node, tokens.data() + (size_t)b * ps);
+        if (!c) break;
+        c->last_used = clock_;
+        pages.push_back(c->page);
+        node = c;
+    }
+
+    int length = (int)pages.size() * ps;
+    if (length > 0) cache.share(pages, length);
+    hit_tokens_ += length;
+    return length;
+}
+
+void PrefixCache::insert(const std::vector<int>& tokens, const KVCache& cache) {
+    assert(&cache.pool() == pool_.get());
+    clock_++;
+    int ps = pool_->page_size();
+    int blocks = std::min(cache.length(), (int)tokens.size()) / ps;
+
+    Node* node = &root_;
+    for (int b = 0; b < blocks; b++) {
+        const int* block = tokens.data() + (size_t)b * ps;
+        Node* c = child(node, block);
+        if (!c) {
+            uint64_t key = hash_block(block, ps);
+            if (node->children.count(key)) return; // hash collision, keep the old block
+            // At the cap: make room from older entries, never the path being extended
+            if (num_nodes_ >= max_pages_ && !evict_one(clock_)) return;
+
+            std::unique_ptr<Node> fresh(new Node());
+            fresh->tokens.assign(block, block + ps);
+            fresh->page = cache.pages()[b];
+            fresh->parent = node;
+            pool_->retain(fresh->page);
+            c = fresh.get();
+            node->children[key] = std::move(fresh);
+            num_nodes_++;
+        }
+        c->last_used = clock_;
+        node = c;
+    }
+}
+
+int PrefixCache::evict(int pages) {
+    int freed = 0;
+    while (freed < pages && evict_one(UINT64_MAX)) freed++;
+    return freed;
+}
+
+bool PrefixCache::evict_one(uint64_t before) {
+    // Least recently used leaf nobody else reads. Dropping it can turn its
+    // parent into the next candidate
+    std::vector<Node*> leaves;
+    collect_evictable(&root_, leaves);
+    Node* victim = nullptr;
+    for (Node* leaf : leaves) {
+        if (leaf->last_used < before && (!victim || leaf->last_used < victim->last_used)) victim = leaf;
+    }
+    if (!victim) return false;
+
+    pool_->release(victim->page);
+    victim->parent->children.erase(hash_block(victim->tokens.data(), pool_->page_size()));
+    num_nodes_--;
+    return true;
+}
+
+int PrefixCache::evictable_pages() const {
+    bool whole;
+    return count_evictable(&root_, &whole);
+}
+
+void PrefixCache::collect_evictable(Node* node, std::vector<Node*>& leaves) const {
+    for (auto& kv : node->children) {
+        Node* c = kv.second.get();
+        if (c->children.empty()) {
+            if (pool_->ref_count(c->page) == 1) leaves.push_back(c);
+        } else {
+            collect_evictable(c, leaves);
+        }
+    }
+}
+
+int PrefixCache::count_evictable(const Node* node, bool* whole) const {
+    // Nodes below node that leaf-first eviction could drop; whole: all of them
+    int count = 0;
+    *whole = true;
+    for (auto& kv : node->children) {
+        const Node* c = kv.second.get();
+        bool below_whole;
+        count += count_evictable(c, &below_whole);
+        if (below_whole && pool_->ref_count(c->page) == 1) {
+            count++;
+        } else {
+            *whole = false;
+        }
+    }
+    return count;
+}
+
+void PrefixCache::release_subtree(Node* node) {
+    for (auto& kv : node->children) {
+        release_subtree(kv.second.get());
+        pool_->release(kv.second->page);
+        num_nodes_--;
+    }
+    node->children.clear();
+}
@@ -0,0 +1,105 @@
+#include "../include/sampling.h"
+#include <cassert>
+#include <algorithm>
+#include <cmath>
+
+typedef std::pair<float, int> Candidate;
+
+static bool more_likely(const Candidate& a, const Candidate& b) {
+    return a.first > b.first;
+}
+
+Sampler::Sampler(const SamplingConfig& config, int vocab_size)
+    : config_(config), vocab_size_(vocab_size), rng_(config.seed), candidates_(vocab_size) {
+    assert(vocab_size > 0);
+}
+
+int Sampler::sample(const float* logits) {
+    // Greedy
+    if (config_.temperature <= 0.0f) return (int)(std::max_element(logits, logits + vocab_size_) - logits);
+
+    float total;
+    int n = keep(logits, &total);
+    std::uniform_real_distribution<float> uniform(0.0f, total);
+    float u = uniform(rng_);
+    for (int i = 0; i < n - 1; i++) {
+        u -= candidates_[i].first;
+        if (u < 0.0f) return candidates_[i].second;
+    }
+    return candidates_[n - 1].second;
+}
+
+void Sampler::probabilities(const float* logits, float* probs) {
+    int V = vocab_size_;
+    std::fill(probs, probs + V, 0.0f);
+    if (config_.temperature <= 0.0f) {
+        probs[std::max_element(logits, logits + V) - logits] = 1.0f;
+        return;
+    }
+
+    float total;
+    int n = keep(logits, &total);
+    for (int i = 0; i < n; i++) probs[candidates_[i].second] = candidates_[i].first / total;
+}
+
+int Sampler::keep(const float* logits, float* total_out) {
+    int V = vocab_size_;
+    float inv_t = 1.0f / config_.temperature;
+    for (int i = 0; i < V; i++) candidates_[i] = Candidate(logits[i] * inv_t, i);
+
+    // Top-k: partial selection, the k best end up in front (unordered)
+    int n = V;
+    if (config_.top_k > 0 && config_.top_k < V) {
+        n = config_.top_k;
+        std::nth_element(candidates_.begin(), candidates_.begin() + (n - 1), candidates_.end(), more_likely);
+    }
+
+    // Softmax over the candidates, left unnormalized
+    float max_logit = -INFINITY;
+    for (int i = 0; i < n; i++) max_logit = std::max(max_logit, candidates_[i].first);
+    float total = 0.0f;
+    for (int i = 0; i < n; i++) {
+        candidates_[i].first = std::exp(candidates_[i].first - max_logit);
+        total += candidates_[i].first;
+    }
+
+    // Top-p: keep the smallest most likely set holding top_p of the mass
+    if (config_.top_p < 1.0f) {
+        // Candidates below (1 - top_p) * total / n can't reach the nucleus:
+        // all of them together hold less than the mass it leaves out.
+        // Dropping them first leaves the quickselect a short list
+        float floor = (1.0f - config_.top_p) * total / n;
+        int kept = 0;
+        for (int i = 0; i < n; i++)
+            if (candidates_[i].first >= floor) std::swap(candidates_[kept++], candidates_[i]);
+        n = nucleus(kept, config_.top_p * total);
+        total = 0.0f;
+        for (int i = 0; i < n; i++) total += candidates_[i].first;
+    }
+
+    *total_out = total;
+    return n;
+}
+
+int Sampler::nucleus(int n, float mass) {
+    // Quickselect on the cumulative mass: the answer m (top-m holds `mass`)
+    // is in (lo, hi], [0, lo) is already in the set with mass `acc`.
+    // Each round halves the range, O(n) expected instead of a sort
+    int lo = 0, hi = n;
+    float acc = 0.0f;
+    while (hi - lo > 1) {
+        int mid = lo + (hi - lo) / 2;
+        std::nth_element(candidates_.begin() + lo, candidates_.begin() + mid,
+                         candidates_.begin() + hi, more_likely);
+        float left = 0.0f;
+        for (int i = lo; i < mid; i++) left += candidates_[i].first;
+
+        if (acc + left >= mass) {
+            hi = mid;
+        } else {
+            acc += left;
+            lo = mid;
+        }
+    }
+    return hi;
+}
@@ -0,0 +1,265 @@
+#include "../include/server.h"
+#include <cassert>
+#include <algorithm>
+
+static double ms_between(InferenceServer::Clock::time_point a, InferenceServer::Clock::time_point b) {
+    return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+InferenceServer::Sequence::Sequence(Pending p, KVCache c, int vocab_size)
+    : pending(std::move(p)), cache(std::move(c)), sampler(pending.request.sampling, vocab_size),
+      context(pending.request.prompt) {}
+
+InferenceServer::InferenceServer(GPT& model, const ServerConfig& config)
+    : model_(model), config_(config) {
+    assert(config.max_batch > 0 && config.max_tokens_per_tick > 0 && config.kv_page_size > 0);
+    // At least one full-length sequence fits, so the oldest can always finish
+    int per_sequence = (model.max_seq_len + config.kv_page_size - 1) / config.kv_page_size;
+    int pages = config.kv_pages > 0 ? config.kv_pages : config.max_batch * per_sequence;
+    pool_ = model.make_page_pool(std::max(pages, per_sequence), config.kv_page_size);
+    stats_.kv_pages_total = pool_->num_pages();
+    if (config.prefix_cache_pages > 0) prefix_.reset(new PrefixCache(pool_, config.prefix_cache_pages));
+}
+
+InferenceServer::~InferenceServer() {
+    stop();
+}
+
+std::future<GenerationResult> InferenceServer::submit(GenerationRequest request) {
+    Pending p;
+    p.request = std::move(request);
+    p.submitted = Clock::now();
+    std::future<GenerationResult> result = p.promise.get_future();
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        p.id = next_id_++;
+        queue_.push_back(std::move(p));
+    }
+    queue_cv_.notify_one();
+    return result;
+}
+
+void InferenceServer::start() {
+    assert(!loop_.joinable() && "server already running");
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        stopping_ = false;
+    }
+    loop_ = std::thread([this] { run(); });
+}
+
+void InferenceServer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        stopping_ = true;
+    }
+    queue_cv_.notify_all();
+    if (loop_.joinable()) loop_.join();
+}
+
+void InferenceServer::run() {
+    for (;;) {
+        if (active_.empty()) {
+            // Idle: sleep until a request arrives or stop() is called
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            queue_cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (stopping_ && queue_.empty()) return;
+        }
+        step();
+    }
+}
+
+void InferenceServer::admit() {
+    // Oldest first, while the pool could hold the next prompt. Pages are
+    // only taken when the prompt is fed, admission just doesn't overcommit
+    int ps = pool_->page_size();
+    int free_pages = pool_->free_pages() + (prefix_ ? prefix_->evictable_pages() : 0);
+    for (auto& seq : active_) free_pages -= ((int)seq->context.size() + ps - 1) / ps - (int)seq->cache.pages().size();
+
+    std::vector<Pending> admitted;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        while (active_.size() + admitted.size() < (size_t)config_.max_batch && !queue_.empty()) {
+            int pages = ((int)queue_.front().request.prompt.size() + ps - 1) / ps;
+            if (pages > free_pages && !(active_.empty() && admitted.empty())) break;
+            free_pages -= pages;
+            admitted.push_back(std::move(queue_.front()));
+            queue_.pop_front();
+        }
+    }
+
+    for (Pending& p : admitted) {
+        const GenerationRequest& req = p.request;
+        bool fits = !req.prompt.empty() && (int)req.prompt.size() <= model_.max_seq_len;
+        std::unique_ptr<Sequence> seq(new Sequence(std::move(p), model_.make_cache(pool_), model_.vocab_size));
+        // Nothing to generate: answered right away with no tokens
+        if (!fits || seq->pending.request.max_new_tokens <= 0) {
+            finish(*seq);
+            continue;
+        }
+        // Start after the longest prefix someone already computed
+        int reused = prefix_ ? prefix_->match(seq->context, seq->cache) : 0;
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.prompt_tokens += seq->context.size();
+            stats_.prefix_hit_tokens += reused;
+        }
+        active_.push_back(std::move(seq));
+    }
+}
+
+bool InferenceServer::schedule(size_t i, int n, std::vector<int>& tokens, std::vector<int>& offsets,
+                               std::vector<KVCache*>& caches, std::vector<Sequence*>& batch) {
+    Sequence& seq = *active_[i];
+    while (!seq.cache.reserve(n)) {
+        // Out of pages: cached prefixes nobody reads go first
+        if (prefix_ && prefix_->evict(1) > 0) continue;
+
+        // Then preempt the youngest sequence that holds some and isn't in
+        // this tick's batch. It starts over from its context later
+        Sequence* victim = nullptr;
+        for (size_t v = active_.size(); v-- > i + 1;) {
+            if (!active_[v]->scheduled && !active_[v]->cache.pages().empty()) {
+                victim = active_[v].get();
+                break;
+            }
+        }
+        if (!victim) return false; // waits for a later tick
+        victim->cache.clear();
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.preemptions++;
+    }
+
+    int fed = seq.cache.length();
+    tokens.insert(tokens.end(), seq.context.begin() + fed, seq.context.begin() + fed + n);
+    offsets.push_back((int)tokens.size());
+    caches.push_back(&seq.cache);
+    batch.push_back(&seq);
+    seq.scheduled = true;
+    return true;
+}
+
+bool InferenceServer::step() {
+    admit();
+    if (active_.empty()) return false;
+
+    Clock::time_point start = Clock::now();
+    int scheduled_count = 0;
+    {
+        GraphArena::Scope tick(arena_);
+
+        // Decoding sequences feed back their last token, then prompts (or
+        // the context of a preempted sequence) are prefilled in chunks
+        // within the tick's token budget. Oldest first in both passes
+        std::vector<int> tokens;
+        std::vector<int> offsets(1, 0);
+        std::vector<KVCache*> caches;
+        std::vector<Sequence*> batch;
+        for (auto& seq : active_) seq->scheduled = false;
+        for (size_t i = 0; i < active_.size(); i++) {
+            Sequence& seq = *active_[i];
+            if ((int)seq.context.size() - seq.cache.length() == 1) schedule(i, 1, tokens, offsets, caches, batch);
+        }
+        int budget = config_.max_tokens_per_tick;
+        for (size_t i = 0; i < active_.size() && budget > 0; i++) {
+            Sequence& seq = *active_[i];
+            // Preempted: reattach whatever part of its context is still cached
+            if (prefix_ && seq.cache.length() == 0 && seq.generated() > 0) prefix_->match(seq.context, seq.cache);
+            int rest = (int)seq.context.size() - seq.cache.length();
+            if (seq.scheduled || rest <= 1) continue; // decoding: first pass
+            int n = std::min(rest, budget);
+            if (schedule(i, n, tokens, offsets, caches, batch)) budget -= n;
+        }
+        scheduled_count = (int)batch.size();
+        if (scheduled_count == 0) return true; // everyone waits on pages this tick
+
+        TensorPtr logits = model_.forward_batch_cached(tokens, offsets, caches);
+
+        // Sequences with their whole context cached pick their next token
+        uint64_t sampled = 0;
+        for (int b = 0; b < scheduled_count; b++) {
+            Sequence& seq = *batch[b];
+            const GenerationRequest& req = seq.pending.request;
+            if (seq.cache.length() < (int)seq.context.size()) continue; // prefill not done yet
+
+            // Prompt just prefilled: publish it for later requests
+            if (prefix_ && seq.generated() == 0) prefix_->insert(seq.context, seq.cache);
+
+            int token = seq.sampler.sample(logits->ptr() + (size_t)b * logits->row_stride);
+            Clock::time_point now = Clock::now();
+            if (seq.generated() == 0) seq.first_token = now;
+            seq.last_token = now;
+            seq.context.push_back(token);
+            sampled++;
+            if (req.on_token) req.on_token(token);
+
+            // The token is fed back next tick, which needs a free position
+            seq.finished = seq.generated() >= req.max_new_tokens ||
+                           token == req.sampling.stop_token ||
+                           seq.cache.length() >= model_.max_seq_len;
+        }
+
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.tokens_generated += sampled;
+        stats_.kv_pages_used = pool_->used_pages();
+        stats_.kv_pages_peak = std::max(stats_.kv_pages_peak, stats_.kv_pages_used);
+    }
+    retire();
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.ticks++;
+    stats_.busy_seconds += std::chrono::duration<double>(Clock::now() - start).count();
+    stats_.kv_pages_used = pool_->used_pages();
+    batch_sum_ += scheduled_count;
+    return true;
+}
+
+void InferenceServer::retire() {
+    size_t kept = 0;
+    for (size_t i = 0; i < active_.size(); i++) {
+        if (active_[i]->finished) {
+            finish(*active_[i]);
+        } else {
+            std::swap(active_[kept++], active_[i]);
+        }
+    }
+    active_.resize(kept);
+}
+
+void InferenceServer::finish(Sequence& seq) {
+    GenerationResult result;
+    result.id = seq.pending.id;
+    result.tokens.assign(seq.context.begin() + seq.pending.request.prompt.size(), seq.context.end());
+    if (prefix_ && seq.cache.length() > 0) prefix_->insert(seq.context, seq.cache);
+    seq.cache.clear(); // pages back to the pool now, not when the sequence is dropped
+    size_t n = result.tokens.size();
+    if (n > 0) {
+        result.ttft_ms = ms_between(seq.pending.submitted, seq.first_token);
+        result.total_ms = ms_between(seq.pending.submitted, seq.last_token);
+        if (n > 1) result.mean_itl_ms = ms_between(seq.first_token, seq.last_token) / (n - 1);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.requests_completed++;
+        if (n > 0) {
+            ttft_sum_ms_ += result.ttft_ms;
+            ttft_count_++;
+        }
+        if (n > 1) {
+            itl_sum_ms_ += ms_between(seq.first_token, seq.last_token);
+            itl_count_ += n - 1;
+        }
+    }
+    seq.pending.promise.set_value(std::move(result));
+}
+
+ServerStats InferenceServer::stats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    ServerStats s = stats_;
+    if (s.busy_seconds > 0.0) s.tokens_per_sec = s.tokens_generated / s.busy_seconds;
+    if (ttft_count_ > 0) s.mean_ttft_ms = ttft_sum_ms_ / ttft_count_;
+    if (itl_count_ > 0) s.mean_itl_ms = itl_sum_ms_ / itl_count_;
+    if (s.ticks > 0) s.mean_batch_size = (double)batch_sum_ / s.ticks;
+    return s;
+}
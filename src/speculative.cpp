@@ -0,0 +1,163 @@
+#include "../include/speculative.h"
+#include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Index drawn from weights [n] summing to total
+static int draw(const float* weights, int n, float total, std::mt19937_64& rng) {
+    float u = std::uniform_real_distribution<float>(0.0f, total)(rng);
+    int last = 0;
+    for (int i = 0; i < n; i++) {
+        if (weights[i] <= 0.0f) continue;
+        u -= weights[i];
+        if (u < 0.0f) return i;
+        last = i;
+    }
+    return last; // rounding left u >= 0 after the last nonzero weight
+}
+
+SpeculativeDecoder::SpeculativeDecoder(GPT& target, GPT& draft, const SpeculativeConfig& config)
+    : target_(target), draft_(draft), config_(config), k_(config.k) {
+    assert(draft.vocab_size == target.vocab_size && "draft and target must share a vocabulary");
+    assert(config.k >= 1 && config.max_k >= config.k);
+}
+
+std::vector<int> SpeculativeDecoder::generate(const std::vector<int>& prompt, int max_new_tokens,
+                                              const SamplingConfig& sampling,
+                                              const std::function<void(int)>& on_token) {
+    int limit = std::min(target_.max_seq_len, draft_.max_seq_len);
+    assert(!prompt.empty() && (int)prompt.size() <= limit);
+    std::vector<int> generated;
+    if (max_new_tokens <= 0) return generated;
+    generated.reserve(max_new_tokens);
+
+    int V = target_.vocab_size;
+    KVCache target_cache = target_.make_cache();
+    KVCache draft_cache = draft_.make_cache();
+    Sampler sampler(sampling, V); // only its distribution, draws below
+    std::mt19937_64 rng(sampling.seed);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    // The context is prompt + committed tokens. Both caches hold a prefix of
+    // it, at least its last token is always still to be fed
+    std::vector<int> context(prompt);
+    std::vector<float> q((size_t)config_.max_k * V); // draft distributions, one row per proposal
+    std::vector<float> p(V);
+    std::vector<int> proposals, tokens, commit;
+    GraphArena arena;
+
+    for (;;) {
+        int n = (int)context.size();
+        int remaining = max_new_tokens - (int)generated.size();
+        // A round commits at most k + 1 tokens, and the target pass must fit
+        int k = std::max(0, std::min({k_, remaining - 1, limit - n}));
+
+        // Draft: k proposals, one cheap step each
+        auto draft_start = Clock::now();
+        proposals.clear();
+        for (int i = 0; i < k; i++) {
+            GraphArena::Scope step(arena);
+            if (i == 0) {
+                tokens.assign(context.begin() + draft_cache.length(), context.end());
+            } else {
+                tokens.assign(1, proposals.back());
+            }
+            float* qi = q.data() + (size_t)i * V;
+            sampler.probabilities(draft_.prefill(tokens, draft_cache)->ptr(), qi);
+            proposals.push_back(draw(qi, V, 1.0f, rng));
+        }
+        double draft_seconds = seconds_since(draft_start);
+
+        // Target: the unfed context and every proposal in one pass, its last
+        // k + 1 rows judge the proposals and give the token after them
+        auto target_start = Clock::now();
+        int accepted = 0;
+        commit.clear();
+        {
+            GraphArena::Scope step(arena);
+            tokens.assign(context.begin() + target_cache.length(), context.end());
+            tokens.insert(tokens.end(), proposals.begin(), proposals.end());
+            TensorPtr logits = target_.score(tokens, target_cache);
+            int first = (int)tokens.size() - (k + 1);
+
+            for (;;) {
+                const float* row = logits->ptr() + (size_t)(first + accepted) * logits->row_stride;
+                sampler.probabilities(row, p.data());
+                if (accepted == k) {
+                    commit.push_back(draw(p.data(), V, 1.0f, rng)); // every proposal passed
+                    break;
+                }
+
+                int d = proposals[accepted];
+                const float* qi = q.data() + (size_t)accepted * V;
+                if (uniform(rng) * qi[d] < p[d]) {
+                    commit.push_back(d);
+                    accepted++;
+                    continue;
+                }
+
+                // Rejected: resample from the target mass the draft undercovers
+                float total = 0.0f;
+                for (int t = 0; t < V; t++) {
+                    p[t] = std::max(p[t] - qi[t], 0.0f);
+                    total += p[t];
+                }
+                if (total <= 0.0f) { // p == q up to rounding, p itself then
+                    sampler.probabilities(row, p.data());
+                    total = 1.0f;
+                }
+                commit.push_back(draw(p.data(), V, total, rng));
+                break;
+            }
+        }
+        double target_seconds = seconds_since(target_start);
+
+        // Keep only the accepted proposals in the caches, the last committed
+        // token is fed next round
+        target_cache.truncate(n + accepted);
+        draft_cache.truncate(std::min(draft_cache.length(), n + accepted));
+
+        stats_.rounds++;
+        stats_.proposed += k;
+        stats_.accepted += accepted;
+        stats_.draft_seconds += draft_seconds;
+        stats_.target_seconds += target_seconds;
+        if (config_.adaptive && k > 0) adapt(k, accepted, draft_seconds, target_seconds);
+
+        for (int token : commit) {
+            context.push_back(token);
+            generated.push_back(token);
+            stats_.generated++;
+            if (on_token) on_token(token);
+            if ((int)generated.size() == max_new_tokens || token == sampling.stop_token) return generated;
+        }
+        if (target_cache.length() == limit) return generated;
+    }
+}
+
+void SpeculativeDecoder::adapt(int k, int accepted, double draft_seconds, double target_seconds) {
+    // Running estimates, recent rounds weigh most
+    const double w = 0.1;
+    acceptance_ += w * ((double)accepted / k - acceptance_);
+    double ratio = draft_seconds / k / std::max(target_seconds, 1e-9);
+    cost_ratio_ = cost_ratio_ < 0.0 ? ratio : cost_ratio_ + w * (ratio - cost_ratio_);
+
+    // Expected tokens per round over its cost, in target passes
+    double a = std::min(acceptance_, 0.99);
+    double best = 0.0;
+    for (int j = 1; j <= config_.max_k; j++) {
+        double gain = (1.0 - std::pow(a, j + 1)) / ((1.0 - a) * (j * cost_ratio_ + 1.0));
+        if (gain > best) {
+            best = gain;
+            k_ = j;
+        }
+    }
+}
@@ -1,17 +1,81 @@
 #include "../include/tensor.h"
+#include "../include/kernels.h"
 #include <random>
 #include <cmath>
 #include <iomanip>
 #include <algorithm>
+#include <cassert>
+#include <atomic>
 
-Tensor::Tensor(int r, int c) : rows(r), cols(c) {
-    data.resize(r * c, 0.0f);
-    grad.resize(r * c, 0.0f);
-    _backward = [](){};
+static thread_local bool grad_mode_enabled = true;
+
+bool GradMode::is_enabled() { return grad_mode_enabled; }
+void GradMode::set_enabled(bool enabled) { grad_mode_enabled = enabled; }
+
+Tensor::Tensor(int r, int c, bool zero_init, int pitch)
+    : rows(r), cols(c),
+      data(TensorAllocator<float>(GraphArena::current())),
+      grad(TensorAllocator<float>(GraphArena::current())),
+      offset(0), row_stride(pitch > 0 ? pitch : c), col_stride(1),
+      requires_grad(GradMode::is_enabled()), retain_grad(false),
+      prev(TensorAllocator<TensorPtr>(GraphArena::current())),
+      arena(GraphArena::current()), visit_mark(0), topo_index(-1) {
+    assert(row_stride >= c);
+    size_t n = (size_t)r * row_stride;
+    if (zero_init) data.resize(n, 0.0f);
+    else data.resize(n); // Pooled memory, not cleared (see TensorAllocator)
+    // No grad buffer here, it is created on the first accumulation
+    if (arena) arena->live_tensors++;
+}
+
+Tensor::~Tensor() {
+    // Inputs only this node owns are released iteratively: letting prev go
+    // recursively would overflow the stack on long chains of ops
+    std::vector<TensorPtr, TensorAllocator<TensorPtr>> pending;
+    for (TensorPtr& p : prev) {
+        if (p.use_count() == 1) pending.push_back(std::move(p));
+    }
+    while (!pending.empty()) {
+        TensorPtr t = std::move(pending.back());
+        pending.pop_back();
+        for (TensorPtr& p : t->prev) {
+            if (p.use_count() == 1) pending.push_back(std::move(p));
+        }
+        t.reset(); // Its remaining inputs are shared, nothing recurses
+    }
+
+    if (arena) arena->live_tensors--;
 }
 
 TensorPtr Tensor::create(int r, int c) {
-    return std::make_shared<Tensor>(r, c);
+    // Node and control block share one allocation, from the arena in a step scope
+    return std::allocate_shared<Tensor>(TensorAllocator<Tensor>(GraphArena::current()), r, c);
+}
+
+TensorPtr Tensor::empty(int r, int c) {
+    return std::allocate_shared<Tensor>(TensorAllocator<Tensor>(GraphArena::current()), r, c, false);
+}
+
+TensorPtr Tensor::create_padded(int r, int c) {
+    const int per_line = (int)(TENSOR_ALIGNMENT / sizeof(float));
+    int pitch = (c + per_line - 1) / per_line * per_line;
+    return std::allocate_shared<Tensor>(TensorAllocator<Tensor>(GraphArena::current()), r, c, true, pitch);
+}
+
+TensorPtr Tensor::view(const TensorPtr& src, int r, int c,
+                       size_t offset, int row_stride, int col_stride) {
+    TensorPtr v = Tensor::empty(0, 0);
+    v->rows = r;
+    v->cols = c;
+    v->base = src->base ? src->base : src;
+    v->offset = offset;
+    v->row_stride = row_stride;
+    v->col_stride = col_stride;
+
+    // Gradients land straight in the base's buffer, so there is no backward
+    // step, prev only orders the view before its source
+    v->track({src});
+    return v;
 }
 
 void Tensor::random_init() {
@@ -19,44 +83,169 @@ void Tensor::random_init() {
     std::mt19937 gen(rd());
     float limit = std::sqrt(6.0f / (rows + cols));
     std::uniform_real_distribution<> dis(-limit, limit);
-    for (auto& val : data) val = dis(gen);
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) at(i, j) = dis(gen); // Row padding stays zero
+    }
+}
+
+size_t Tensor::row_alignment() const {
+    uintptr_t addr = (uintptr_t)ptr();
+    size_t stride_bytes = rows > 1 ? (size_t)row_stride * sizeof(float) : 0;
+    size_t a = TENSOR_ALIGNMENT;
+    while (a > 1 && ((addr & (a - 1)) || (stride_bytes & (a - 1)))) a >>= 1;
+    return a;
 }
 
 void Tensor::zero_grad() {
+    if (base) {
+        if (base->grad.empty()) return;
+        for (int i = 0; i < rows; i++) {
+            for (int j = 0; j < cols; j++) grad_at(i, j) = 0.0f;
+        }
+        return;
+    }
+    if (grad.empty()) return; // Nothing ever flowed in
     std::fill(grad.begin(), grad.end(), 0.0f);
 }
 
-float& Tensor::at(int i, int j) { return data[i * cols + j]; }
-float& Tensor::grad_at(int i, int j) { return grad[i * cols + j]; }
+bool Tensor::track(std::initializer_list<TensorPtr> inputs) {
+    requires_grad = false;
+    if (!GradMode::is_enabled()) return false;
+
+    for (const auto& t : inputs) {
+        if (t->requires_grad) requires_grad = true;
+    }
+    if (requires_grad) prev.assign(inputs.begin(), inputs.end());
+    return requires_grad;
+}
+
+float* Tensor::grad_data() {
+    if (base) return base->grad_data() + offset;
+    if (grad.empty()) grad.resize(data.size(), 0.0f);
+    return grad.data();
+}
+
+float& Tensor::grad_at(int i, int j) {
+    return grad_data()[(size_t)i * row_stride + (size_t)j * col_stride];
+}
+
+// === GRAPH ORDER ===
+
+// Fresh mark per traversal, nodes never need to be unmarked
+static std::atomic<uint64_t> visit_counter(0);
+
+/**
+ * Shape of the last graph walked with reuse_order, by topological position:
+ * node i has prev_begin[i+1] - prev_begin[i] inputs, at positions
+ * prev_index[prev_begin[i]...]. The root is the last node.
+ */
+struct BackwardPlan {
+    std::vector<int> prev_begin;
+    std::vector<int> prev_index;
+};
 
-void Tensor::backward() {
-    std::vector<Tensor*> topo;
-    std::set<Tensor*> visited;
+static thread_local BackwardPlan last_plan;
 
-    std::function<void(Tensor*)> build_topo = [&](Tensor* v) {
-        if (visited.find(v) == visited.end()) {
-            visited.insert(v);
-            for (auto child : v->prev) {
-                build_topo(child.get());
+// Iterative post-order DFS, deep graphs can't overflow the stack
+static void build_topo(Tensor* root, uint64_t mark, std::vector<Tensor*>& topo) {
+    static thread_local std::vector<std::pair<Tensor*, size_t>> stack;
+    stack.clear();
+    topo.clear();
+
+    root->visit_mark = mark;
+    stack.push_back({root, 0});
+    while (!stack.empty()) {
+        Tensor* v = stack.back().first;
+        size_t& next = stack.back().second;
+        if (next < v->prev.size()) {
+            Tensor* child = v->prev[next++].get();
+            if (child->visit_mark != mark) {
+                child->visit_mark = mark;
+                stack.push_back({child, 0});
             }
+        } else {
+            v->topo_index = (int)topo.size();
             topo.push_back(v);
+            stack.pop_back();
         }
-    };
+    }
+}
 
-    build_topo(this);
+static void record_plan(const std::vector<Tensor*>& topo, BackwardPlan& plan) {
+    plan.prev_begin.clear();
+    plan.prev_index.clear();
+    plan.prev_begin.push_back(0);
+    for (Tensor* t : topo) {
+        for (const TensorPtr& p : t->prev) plan.prev_index.push_back(p->topo_index);
+        plan.prev_begin.push_back((int)plan.prev_index.size());
+    }
+}
+
+// Map the plan onto the graph under root, false if the shape differs
+static bool replay_plan(Tensor* root, uint64_t mark, const BackwardPlan& plan,
+                        std::vector<Tensor*>& topo) {
+    int n = (int)plan.prev_begin.size() - 1;
+    if (n <= 0) return false;
+    topo.assign(n, nullptr);
+    topo[n - 1] = root;
+    root->visit_mark = mark;
+
+    // Inputs always sit below their consumer, so walking down fills every slot
+    for (int i = n - 1; i >= 0; i--) {
+        Tensor* t = topo[i];
+        if (!t) return false;
+        int begin = plan.prev_begin[i];
+        if (t->prev.size() != (size_t)(plan.prev_begin[i + 1] - begin)) return false;
 
+        for (size_t j = 0; j < t->prev.size(); j++) {
+            Tensor* p = t->prev[j].get();
+            Tensor*& slot = topo[plan.prev_index[begin + j]];
+            if (slot == p) continue;
+            // Empty slot, and p must not already own another one
+            if (slot || p->visit_mark == mark) return false;
+            slot = p;
+            p->visit_mark = mark;
+        }
+    }
+    return true;
+}
+
+void Tensor::backward(bool reuse_order) {
+    static thread_local std::vector<Tensor*> topo;
+    uint64_t mark = ++visit_counter;
+
+    if (!reuse_order || !replay_plan(this, mark, last_plan, topo)) {
+        if (reuse_order) mark = ++visit_counter; // The failed replay left marks behind
+        build_topo(this, mark, topo);
+        if (reuse_order) record_plan(topo, last_plan);
+    }
+
+    assert(requires_grad && "backward() on a tensor that doesn't require grad");
+    assert(!base && "backward() on a view, call it on a contiguous() copy");
+    grad_data();
     std::fill(grad.begin(), grad.end(), 1.0f);
 
     for (auto it = topo.rbegin(); it != topo.rend(); ++it) {
-        (*it)->_backward();
+        Tensor* t = *it;
+        if (!t->requires_grad || t->grad.empty()) continue; // No gradient reached it
+
+        t->_backward();
+
+        // Intermediate gradients are dead once propagated, free them early
+        if (!t->prev.empty() && !t->retain_grad) {
+            t->grad.clear();
+            t->grad.shrink_to_fit();
+        }
     }
 }
 
 void Tensor::print() const {
     std::cout << "Tensor (" << rows << "x" << cols << "):\n";
+    const float* p = ptr();
     for (int i = 0; i < rows; i++) {
         for (int j = 0; j < cols; j++) {
-            std::cout << std::fixed << std::setprecision(4) << data[i * cols + j] << " ";
+            std::cout << std::fixed << std::setprecision(4)
+                      << p[(size_t)i * row_stride + (size_t)j * col_stride] << " ";
         }
         std::cout << "\n";
     }
@@ -64,28 +253,46 @@ void Tensor::print() const {
 
 void Tensor::print_grad() const {
     std::cout << "Gradient (" << rows << "x" << cols << "):\n";
+    const FloatBuffer& g = base ? base->grad : grad;
+    if (g.empty()) {
+        std::cout << "(no gradient)\n";
+        return;
+    }
+    const float* p = g.data() + offset;
     for (int i = 0; i < rows; i++) {
         for (int j = 0; j < cols; j++) {
-            std::cout << std::fixed << std::setprecision(4) << grad[i * cols + j] << " ";
+            std::cout << std::fixed << std::setprecision(4)
+                      << p[(size_t)i * row_stride + (size_t)j * col_stride] << " ";
         }
         std::cout << "\n";
     }
 }
 
 float Tensor::mean() const {
-    if (data.empty()) return 0.0f;
-    float sum = 0.0f;
-    for (const auto& val : data) sum += val;
-    return sum / data.size();
+    if (size() == 0) return 0.0f;
+    if (!is_contiguous()) {
+        float s = 0.0f;
+        for (int i = 0; i < rows; i++) {
+            for (int j = 0; j < cols; j++) s += ptr()[(size_t)i * row_stride + (size_t)j * col_stride];
+        }
+        return s / size();
+    }
+    return kernels().sum(ptr(), size()) / size();
 }
 
 float Tensor::std_dev() const {
-    if (data.empty()) return 0.0f;
+    if (size() == 0) return 0.0f;
     float m = mean();
     float variance = 0.0f;
-    for (const auto& val : data) {
-        float diff = val - m;
-        variance += diff * diff;
+    if (!is_contiguous()) {
+        for (int i = 0; i < rows; i++) {
+            for (int j = 0; j < cols; j++) {
+                float d = ptr()[(size_t)i * row_stride + (size_t)j * col_stride] - m;
+                variance += d * d;
+            }
+        }
+    } else {
+        variance = kernels().sq_dev_sum(ptr(), m, size());
     }
-    return std::sqrt(variance / data.size());
-}
\ No newline at end of file
+    return std::sqrt(variance / size());
+}
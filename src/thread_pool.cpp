@@ -0,0 +1,127 @@
+#include "../include/thread_pool.h"
+#include <cstdlib>
+#include <algorithm>
+
+static thread_local bool t_in_parallel = false;
+
+ThreadPool& ThreadPool::instance() {
+    static ThreadPool pool;
+    return pool;
+}
+
+ThreadPool::ThreadPool()
+    : stop_(false), active_(false), generation_(0), in_job_(0),
+      fn_(nullptr), ctx_(nullptr), n_(0), chunk_(1), num_chunks_(0),
+      next_chunk_(0), done_chunks_(0) {
+    int n = (int)std::thread::hardware_concurrency();
+
+    const char* env = std::getenv("LLMON_NUM_THREADS");
+    if (env && std::atoi(env) > 0) n = std::atoi(env);
+
+    num_threads_ = std::max(1, n);
+}
+
+ThreadPool::~ThreadPool() {
+    stop_workers();
+}
+
+bool ThreadPool::in_parallel() {
+    return t_in_parallel;
+}
+
+void ThreadPool::set_num_threads(int n) {
+    std::lock_guard<std::mutex> submit(submit_mutex_);
+    stop_workers();
+    num_threads_ = std::max(1, n);
+}
+
+void ThreadPool::start_workers() {
+    // Workers are spawned lazily, on the first parallel region
+    if ((int)workers_.size() == num_threads_ - 1) return;
+    stop_ = false;
+    for (int i = (int)workers_.size(); i < num_threads_ - 1; i++) {
+        workers_.emplace_back(&ThreadPool::worker_loop, this);
+    }
+}
+
+void ThreadPool::stop_workers() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& t : workers_) t.join();
+    workers_.clear();
+}
+
+void ThreadPool::work() {
+    for (;;) {
+        int64_t c = next_chunk_.fetch_add(1);
+        if (c >= num_chunks_) break;
+
+        int64_t begin = c * chunk_;
+        int64_t end = std::min(n_, begin + chunk_);
+        fn_(ctx_, begin, end);
+
+        if (done_chunks_.fetch_add(1) + 1 == num_chunks_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_cv_.notify_all();
+        }
+    }
+}
+
+void ThreadPool::worker_loop() {
+    t_in_parallel = true;
+    uint64_t seen = 0;
+
+    for (;;) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_cv_.wait(lock, [&]() { return stop_ || (active_ && generation_ != seen); });
+        if (stop_) return;
+
+        seen = generation_;
+        in_job_++;
+        lock.unlock();
+
+        work();
+
+        lock.lock();
+        if (--in_job_ == 0) done_cv_.notify_all();
+    }
+}
+
+void ThreadPool::run(int64_t n, int64_t chunk, ChunkFn fn, void* ctx) {
+    // Another thread owns the pool (or we are nested): just do it here
+    std::unique_lock<std::mutex> submit(submit_mutex_, std::try_to_lock);
+    if (!submit.owns_lock() || t_in_parallel) {
+        fn(ctx, 0, n);
+        return;
+    }
+
+    start_workers();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fn_ = fn;
+        ctx_ = ctx;
+        n_ = n;
+        chunk_ = chunk;
+        num_chunks_ = (n + chunk - 1) / chunk;
+        next_chunk_ = 0;
+        done_chunks_ = 0;
+        active_ = true;
+        generation_++;
+    }
+    work_cv_.notify_all();
+
+    // The caller works too
+    t_in_parallel = true;
+    work();
+    t_in_parallel = false;
+
+    // Wait for the last chunk and for every worker to leave the job,
+    // fn and ctx live on the caller's stack
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [&]() { return done_chunks_ == num_chunks_ && in_job_ == 0; });
+    active_ = false;
+}